@@ -1,788 +1,5917 @@
 #ifndef APILOG_H_
 #define APILOG_H_
 
+#if defined( APILOG_PROFILE ) || defined( APILOG_HISTOGRAM ) || \
+    defined( APILOG_CALLTREE ) || defined( APILOG_CHROME ) || \
+    defined( APILOG_GC ) || defined( APILOG_COROUTINES ) || \
+    defined( APILOG_CHECKS )
+#define APILOG_TIMING
+#endif
+
+/* Strict ISO C modes hide the POSIX functions needed for the
+ * background writer thread (`nanosleep()`), for memory-mapped trace
+ * files (`ftruncate()`, `posix_fallocate()`), and the monotonic clocks
+ * for timing (`clock_gettime()`). This only helps if no system header
+ * has been included before this file. */
+#if (defined( APILOG_ASYNC ) || defined( APILOG_MMAP ) || \
+     defined( APILOG_TIMING )) && defined( __STRICT_ANSI__ ) && \
+    !defined( _WIN32 ) && !defined( _POSIX_C_SOURCE ) && \
+    !defined( _XOPEN_SOURCE )
+#define _POSIX_C_SOURCE 200112L
+#endif
+
 #include <stddef.h>
 #include <stdarg.h>
+#ifndef APILOG_DECODER
 #include <lua.h>
 #include <lauxlib.h>
+#endif
+
+
+#ifndef __has_attribute
+#define __has_attribute( x ) 0
+#endif
+
+/* By default every translation unit that includes this file gets
+ * its own static copies of all functions. Alternatively define
+ * APILOG_EXTERN for all translation units and APILOG_IMPLEMENTATION
+ * in exactly one of them: that one defines all functions with
+ * external linkage, the others only see declarations and macros. */
+#if defined( APILOG_EXTERN ) && !defined( APILOG_IMPLEMENTATION )
+#define APILOG_DECLARE_ONLY
+#endif
+
+#ifndef APILOG_API
+#if defined( APILOG_IMPLEMENTATION )
+#define APILOG_API
+#elif defined( APILOG_EXTERN )
+#define APILOG_API extern
+#elif defined( __GNUC__ ) || __has_attribute( __unused__ )
+#define APILOG_API __attribute__((__unused__)) static
+#else
+#define APILOG_API static
+#endif
+#endif
+
+
+/* Letters used for the types of stack slots. Stack snapshots store
+ * indices into this string. */
+#define APILOG_TYPECHARS "nblidstfuc?"
+
+
+#if (defined( APILOG_BINARY ) && !defined( APILOG_DECLARE_ONLY )) || \
+    defined( APILOG_DECODER )
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Layout of the binary trace format (all integers little endian):
+ *
+ *     block:  "ALG1" stream:u32[2] size:u32 record...
+ *     site:   'S' 0 0 0 id:u32 line:u32 apilen:u16 funclen:u16
+ *             filelen:u16 0:u16 api func file
+ *     call:   'C' skipped:u24 id:u32 top:u32 n:u32 code:u4[n]
+ *
+ * Every translation unit writes its own stream of blocks, and site
+ * ids are only unique within a stream. Records never cross block
+ * boundaries. The type codes are indices into APILOG_TYPECHARS
+ * packed two per byte (low nibble first). `n` is less than `top`
+ * only if the stack didn't fit into the trace buffer. `skipped` is
+ * the number of preceding calls omitted by sampling.
+ */
+#define APILOG_BLOCKHEAD 16
+#define APILOG_SITEHEAD 20
+#define APILOG_CALLHEAD 16
+#define APILOG_MAXNAME 4095
+
+
+APILOG_API void apilog_put16( unsigned char* p, unsigned v ) {
+    p[ 0 ] = (unsigned char)(v & 0xFF);
+    p[ 1 ] = (unsigned char)((v >> 8) & 0xFF);
+}
+
+APILOG_API void apilog_put32( unsigned char* p, unsigned long v ) {
+    p[ 0 ] = (unsigned char)(v & 0xFF);
+    p[ 1 ] = (unsigned char)((v >> 8) & 0xFF);
+    p[ 2 ] = (unsigned char)((v >> 16) & 0xFF);
+    p[ 3 ] = (unsigned char)((v >> 24) & 0xFF);
+}
+
+APILOG_API unsigned apilog_get16( unsigned char const* p ) {
+    return p[ 0 ] | ((unsigned)p[ 1 ] << 8);
+}
+
+APILOG_API unsigned long apilog_get32( unsigned char const* p ) {
+    return p[ 0 ] | ((unsigned long)p[ 1 ] << 8) |
+           ((unsigned long)p[ 2 ] << 16) | ((unsigned long)p[ 3 ] << 24);
+}
+
+
+typedef struct {
+    char* api;
+    char* func;
+    char* filename;
+    unsigned long lineno;
+} apilog_dsite;
+
+typedef struct apilog_dstream {
+    struct apilog_dstream* next;
+    unsigned long id[ 2 ];
+    apilog_dsite* sites;
+    size_t nsites;
+} apilog_dstream;
+
+
+APILOG_API char* apilog_dstring( unsigned char const* p, size_t n ) {
+    char* s = (char*)malloc( n+1 );
+    if( s ) {
+        memcpy( s, p, n );
+        s[ n ] = '\0';
+    }
+    return s;
+}
+
+
+/* Decodes a single record and returns its size, or 0 if the record
+ * is malformed. */
+APILOG_API size_t apilog_decode_record( apilog_dstream* s,
+                                        unsigned char const* p,
+                                        size_t n,
+                                        FILE* out ) {
+    unsigned long id = 0;
+    if( n < 8 )
+        return 0;
+    id = apilog_get32( p+4 );
+    if( p[ 0 ] == 'S' && n >= APILOG_SITEHEAD ) {
+        size_t apilen = apilog_get16( p+12 );
+        size_t funclen = apilog_get16( p+14 );
+        size_t filelen = apilog_get16( p+16 );
+        size_t size = APILOG_SITEHEAD + apilen + funclen + filelen;
+        apilog_dsite* d = NULL;
+        if( n < size )
+            return 0;
+        if( id >= s->nsites ) {
+            apilog_dsite* sites = (apilog_dsite*)realloc( s->sites,
+                                                          (id+1) * sizeof( *sites ) );
+            if( sites == NULL )
+                return 0;
+            memset( sites + s->nsites, 0, (id+1-s->nsites) * sizeof( *sites ) );
+            s->sites = sites;
+            s->nsites = id+1;
+        }
+        d = s->sites + id;
+        free( d->api );
+        free( d->func );
+        free( d->filename );
+        d->api = apilog_dstring( p+APILOG_SITEHEAD, apilen );
+        d->func = apilog_dstring( p+APILOG_SITEHEAD+apilen, funclen );
+        d->filename = apilog_dstring( p+APILOG_SITEHEAD+apilen+funclen, filelen );
+        d->lineno = apilog_get32( p+8 );
+        if( d->api == NULL || d->func == NULL || d->filename == NULL )
+            return 0;
+        return size;
+    } else if( p[ 0 ] == 'C' && n >= APILOG_CALLHEAD ) {
+        unsigned long top = apilog_get32( p+8 );
+        size_t k = apilog_get32( p+12 );
+        size_t size = APILOG_CALLHEAD + (k+1)/2;
+        apilog_dsite* d = NULL;
+        size_t i = 0;
+        if( n < size || id >= s->nsites || s->sites[ id ].api == NULL )
+            return 0;
+        d = s->sites + id;
+        fprintf( out, "%s in %s@%s:%lu:  [", d->api, d->func,
+                 d->filename, d->lineno );
+        for( i = 0; i < k; ++i ) {
+            unsigned code = p[ APILOG_CALLHEAD+i/2 ] >> (4*(i%2)) & 0x0F;
+            char c[ 3 ] = { ' ', '?', '\0' };
+            if( code < sizeof( APILOG_TYPECHARS )-1 )
+                c[ 1 ] = APILOG_TYPECHARS[ code ];
+            fputs( c, out );
+        }
+        if( k < top )
+            fputs( " ...", out );
+        if( p[ 1 ] || p[ 2 ] || p[ 3 ] )
+            fprintf( out, " ] (%lu skipped)\n", p[ 1 ] |
+                     ((unsigned long)p[ 2 ] << 8) | ((unsigned long)p[ 3 ] << 16) );
+        else
+            fputs( " ]\n", out );
+        return size;
+    }
+    return 0;
+}
+
+
+/* Converts a binary trace (see APILOG_BINARY) back to the usual text
+ * format. Returns 0 on success, -1 on malformed input or when out of
+ * memory. */
+APILOG_API int apilog_decode( FILE* in, FILE* out ) {
+    unsigned char head[ APILOG_BLOCKHEAD ];
+    unsigned char* block = NULL;
+    size_t blocksize = 0;
+    apilog_dstream* streams = NULL;
+    size_t got = 0;
+    int status = 0;
+    while( status == 0 &&
+           (got = fread( head, 1, APILOG_BLOCKHEAD, in )) == APILOG_BLOCKHEAD ) {
+        unsigned long a = apilog_get32( head+4 );
+        unsigned long b = apilog_get32( head+8 );
+        size_t size = apilog_get32( head+12 );
+        size_t pos = 0;
+        apilog_dstream* s = streams;
+        if( memcmp( head, "ALG1", 4 ) != 0 ) {
+            status = -1;
+            break;
+        }
+        if( size > blocksize ) {
+            unsigned char* nb = (unsigned char*)realloc( block, size );
+            if( nb == NULL ) {
+                status = -1;
+                break;
+            }
+            block = nb;
+            blocksize = size;
+        }
+        if( fread( block, 1, size, in ) != size ) {
+            status = -1;
+            break;
+        }
+        while( s != NULL && (s->id[ 0 ] != a || s->id[ 1 ] != b) )
+            s = s->next;
+        if( s == NULL ) {
+            s = (apilog_dstream*)calloc( 1, sizeof( *s ) );
+            if( s == NULL ) {
+                status = -1;
+                break;
+            }
+            s->id[ 0 ] = a;
+            s->id[ 1 ] = b;
+            s->next = streams;
+            streams = s;
+        }
+        while( pos < size ) {
+            size_t n = apilog_decode_record( s, block+pos, size-pos, out );
+            if( n == 0 ) {
+                status = -1;
+                break;
+            }
+            pos += n;
+        }
+    }
+    if( got != 0 && got != APILOG_BLOCKHEAD )
+        status = -1;
+    while( streams != NULL ) {
+        apilog_dstream* s = streams;
+        size_t i = 0;
+        streams = s->next;
+        for( i = 0; i < s->nsites; ++i ) {
+            free( s->sites[ i ].api );
+            free( s->sites[ i ].func );
+            free( s->sites[ i ].filename );
+        }
+        free( s->sites );
+        free( s );
+    }
+    free( block );
+    return status;
+}
+#endif /* APILOG_BINARY || APILOG_DECODER */
+
+
+#ifndef APILOG_DECODER
+
+
+#if defined( __GNUC__ )
+#define APILOG_LOCK( l ) \
+    while( __sync_lock_test_and_set( &(l), 1 ) ) {}
+#define APILOG_UNLOCK( l ) \
+    __sync_lock_release( &(l) )
+#define APILOG_PUBLISH() \
+    __sync_synchronize()
+#else
+#define APILOG_LOCK( l ) ((void)0)
+#define APILOG_UNLOCK( l ) ((void)0)
+#define APILOG_PUBLISH() ((void)0)
+#endif
+
+#ifndef APILOG_TLS
+#if defined( __STDC_VERSION__ ) && __STDC_VERSION__+0 >= 201112L && \
+    !defined( __STDC_NO_THREADS__ )
+#define APILOG_TLS _Thread_local
+#elif defined( __GNUC__ )
+#define APILOG_TLS __thread
+#elif defined( _MSC_VER )
+#define APILOG_TLS __declspec( thread )
+#else
+#define APILOG_TLS
+#endif
+#endif
+
+
+/* Every expansion of a wrapper macro passes the address of a static
+ * call site descriptor instead of the file name, line number, and
+ * API name. This needs GNU statement expressions, for other
+ * compilers (or if APILOG_PORTABLE is defined) the descriptors are
+ * looked up in a hash table at runtime. The descriptor also caches
+ * the result of the runtime filter (see `apilog_filter_site()`). */
+typedef struct apilog_callsite {
+    char const* filename;
+    int lineno;
+    char const* api;
+    unsigned volatile filter;
+} apilog_callsite;
+
+/* Wrappers of API functions that change a single stack slot (e.g.
+ * `lua_replace()`) pass its index to the diff mode via APILOG_HINT.
+ * The hint lives in the translation unit that defines the functions,
+ * so in APILOG_EXTERN mode it is set via a function call. */
+#if defined( APILOG_DIFF )
+APILOG_API void apilog_set_hint( int index );
+#define APILOG_HINT( i ) apilog_set_hint( i )
+#else
+#define APILOG_HINT( i ) ((void)0)
+#endif
+
+#if defined( __GNUC__ ) && !defined( APILOG_PORTABLE )
+#define APILOG_CALLSITE( api ) \
+    (__extension__ ({ \
+        static apilog_callsite apilog_cs_ = { __FILE__, __LINE__, api, 0 }; \
+        &apilog_cs_; \
+    }))
+#else
+#define APILOG_INTERN_SITES
+#define APILOG_CALLSITE( api ) \
+    apilog_callsite_intern( __FILE__, __LINE__, api )
+#endif
+
+
+#if defined( APILOG_DECLARE_ONLY )
+#include <stdio.h>
+
+#if defined( APILOG_INTERN_SITES )
+APILOG_API apilog_callsite const* apilog_callsite_intern( char const* filename,
+                                                          int lineno,
+                                                          char const* api );
+#endif
+APILOG_API long apilog_site_id( apilog_callsite const* cs,
+                                char const* func );
+#if defined( APILOG_BINARY ) || defined( APILOG_BUFFERED ) || \
+    defined( APILOG_ASYNC ) || defined( APILOG_MMAP )
+APILOG_API void apilog_flush( void );
+#endif
+#if defined( APILOG_ASYNC )
+APILOG_API unsigned long apilog_dropped( void );
+#endif
+#if defined( APILOG_FILTER )
+APILOG_API int apilog_filter( char const* spec );
+#endif
+#if defined( APILOG_SAMPLE )
+APILOG_API void apilog_sample( unsigned long n );
+#endif
+#if defined( APILOG_PROFILE )
+APILOG_API void apilog_profile_report( FILE* out );
+#endif
+#if defined( APILOG_HISTOGRAM )
+APILOG_API void apilog_histogram_report( FILE* out );
+#endif
+#if defined( APILOG_RECORDER )
+APILOG_API void apilog_dump( void );
+#endif
+#if defined( APILOG_SUMMARY )
+APILOG_API void apilog_summary_report( FILE* out );
+#endif
+#if defined( APILOG_CALLTREE )
+APILOG_API void apilog_calltree_report( FILE* out, FILE* folded );
+#endif
+#if defined( APILOG_ALLOC )
+APILOG_API void apilog_alloc_report( FILE* out );
+#endif
+#if defined( APILOG_GC )
+APILOG_API void apilog_gc_report( FILE* out );
+#endif
+#if defined( APILOG_BUFSTATS )
+APILOG_API void apilog_buffer_report( FILE* out );
+#endif
+#if defined( APILOG_COROUTINES )
+APILOG_API void apilog_coroutine_report( FILE* out );
+#endif
+#if defined( APILOG_CHECKS )
+APILOG_API void apilog_check_report( FILE* out );
+#endif
+#if defined( APILOG_REFS )
+APILOG_API void apilog_ref_report( FILE* out );
+#endif
+#if defined( APILOG_PRESIZE )
+APILOG_API void apilog_presize_report( FILE* out );
+#endif
+#if defined( APILOG_EXTRASPACE ) && LUA_VERSION_NUM >= 503 && \
+    (defined( APILOG_DIFF ) || defined( APILOG_RECORDER ))
+APILOG_API lua_State* apilog_xspace_init( lua_State* L );
+#endif
+
+#else /* full definitions */
+
+
+#if defined( APILOG_INTERNALS )
+/* Reads the type tags directly from the stack slots of the current
+ * function instead of calling `lua_type()` (and `lua_isinteger()`)
+ * for every slot. This needs the private headers (`lstate.h`, etc.)
+ * of the exact Lua version that is used. */
+#include <lstate.h>
+
+#if LUA_VERSION_NUM >= 504
+#if defined( LUA_VERSION_RELEASE_NUM ) && LUA_VERSION_RELEASE_NUM >= 50406
+#define APILOG_BASE( L ) ((L)->ci->func.p + 1)
+#else
+#define APILOG_BASE( L ) ((L)->ci->func + 1)
+#endif
+#define APILOG_TAG( p ) (rawtt( s2v( p ) ) & 0x3F)
+#define APILOG_INTTAG LUA_VNUMINT
+#elif LUA_VERSION_NUM == 503
+#define APILOG_BASE( L ) ((L)->ci->func + 1)
+#define APILOG_TAG( p ) (rttype( p ) & 0x3F)
+#define APILOG_INTTAG LUA_TNUMINT
+#elif LUA_VERSION_NUM == 502
+#define APILOG_BASE( L ) ((L)->ci->func + 1)
+#define APILOG_TAG( p ) (rttype( p ) & 0x3F)
+#else
+#define APILOG_BASE( L ) ((L)->base)
+#define APILOG_TAG( p ) (ttype( p ) & 0x3F)
+#endif
+
+/* Maps (non-collectable) type tags including variant bits to the
+ * codes used for `APILOG_TYPECHARS`. */
+static unsigned char apilog_tagcodes[ 64 ];
+static int volatile apilog_tagcodes_ready = 0;
+
+
+APILOG_API void apilog_tagcodes_init( void ) {
+    int t = 0;
+    for( t = 0; t < 64; ++t ) {
+        unsigned char c = 10;
+        switch( t & 0x0F ) {
+            case LUA_TNIL: c = 0; break;
+            case LUA_TBOOLEAN: c = 1; break;
+            case LUA_TLIGHTUSERDATA: c = 2; break;
+            case LUA_TNUMBER:
+#if defined( APILOG_INTTAG )
+                c = t == APILOG_INTTAG ? 3 : 4;
+#else
+                c = 4;
+#endif
+                break;
+            case LUA_TSTRING: c = 5; break;
+            case LUA_TTABLE: c = 6; break;
+            case LUA_TFUNCTION: c = 7; break;
+            case LUA_TUSERDATA: c = 8; break;
+            case LUA_TTHREAD: c = 9; break;
+        }
+        apilog_tagcodes[ t ] = c;
+    }
+    APILOG_PUBLISH();
+    apilog_tagcodes_ready = 1;
+}
+#endif /* APILOG_INTERNALS */
+
+
+APILOG_API int apilog_typecode( lua_State* L, int i ) {
+#if defined( APILOG_INTERNALS )
+    if( i > 0 ) {
+        if( !apilog_tagcodes_ready )
+            apilog_tagcodes_init();
+        return apilog_tagcodes[ APILOG_TAG( APILOG_BASE( L ) + (i-1) ) ];
+    }
+#endif
+    switch( lua_type( L, i ) ) {
+        case LUA_TNONE: /* fall through */
+        case LUA_TNIL: return 0;
+        case LUA_TBOOLEAN: return 1;
+        case LUA_TLIGHTUSERDATA: return 2;
+        case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+            if( lua_isinteger( L, i ) )
+                return 3;
+#endif
+            return 4;
+        case LUA_TSTRING: return 5;
+        case LUA_TTABLE: return 6;
+        case LUA_TFUNCTION: return 7;
+        case LUA_TUSERDATA: return 8;
+        case LUA_TTHREAD: return 9;
+        default: return 10;
+    }
+}
+
+
+/* Stores the type codes of the `n` stack slots starting at (positive)
+ * index `lo` in `out`. Backends take snapshots in chunks of
+ * APILOG_CHUNK slots. */
+#define APILOG_CHUNK 64
+
+APILOG_API void apilog_snapshot( lua_State* L, int lo, int n,
+                                 unsigned char* out ) {
+    int i = 0;
+#if defined( APILOG_INTERNALS )
+    StkId p = APILOG_BASE( L ) + (lo-1);
+    if( !apilog_tagcodes_ready )
+        apilog_tagcodes_init();
+    for( i = 0; i < n; ++i, ++p )
+        out[ i ] = apilog_tagcodes[ APILOG_TAG( p ) ];
+#else
+    for( i = 0; i < n; ++i )
+        out[ i ] = (unsigned char)apilog_typecode( L, lo+i );
+#endif
+}
+
+
+#if defined( APILOG_DIFF ) && defined( APILOG_BINARY )
+#error "APILOG_DIFF only works with text output"
+#endif
+
+#if defined( APILOG_ASYNC )
+#if defined( APILOG_BINARY )
+#error "APILOG_ASYNC only works with text output"
+#endif
+#if !defined( __GNUC__ )
+#error "APILOG_ASYNC needs GCC-compatible atomic builtins"
+#endif
+#ifndef APILOG_BUFFERED
+#define APILOG_BUFFERED
+#endif
+#endif
+
+#if defined( APILOG_MMAP )
+#if defined( APILOG_BINARY )
+#error "APILOG_MMAP only works with text output"
+#endif
+#if defined( _WIN32 )
+#error "APILOG_MMAP needs POSIX mmap()"
+#endif
+#if !defined( __GNUC__ )
+#error "APILOG_MMAP needs GCC-compatible atomic builtins"
+#endif
+#ifndef APILOG_BUFFERED
+#define APILOG_BUFFERED
+#endif
+#endif
+
+#if defined( APILOG_CHROME ) && defined( APILOG_RDTSC )
+#error "APILOG_CHROME needs nanosecond timestamps"
+#endif
+
+#if defined( APILOG_RECORDER ) || defined( APILOG_SUMMARY ) || \
+    defined( APILOG_CALLTREE ) || defined( APILOG_COROUTINES )
+#define APILOG_STATES
+#endif
+
+#if defined( APILOG_EXTRASPACE ) && LUA_VERSION_NUM < 503
+#undef APILOG_EXTRASPACE
+#endif
+
+#if defined( APILOG_DIFF )
+#define APILOG_STATES
+#endif
+
+#if defined( __GNUC__ )
+#define APILOG_ADD( var, v ) \
+    ((void)__sync_fetch_and_add( &(var), (v) ))
+#else
+#define APILOG_ADD( var, v ) \
+    ((void)((var) += (v)))
+#endif
+
+#if defined( APILOG_TIMING )
+/* Timestamps for profiling: nanoseconds by default, or CPU cycles
+ * (via `rdtsc`) if APILOG_RDTSC is defined on x86. */
+typedef unsigned long long apilog_ticks;
+
+#if defined( APILOG_RDTSC ) && defined( __GNUC__ ) && \
+    (defined( __i386__ ) || defined( __x86_64__ ))
+#include <x86intrin.h>
+#define APILOG_TICKS "cycles"
+
+APILOG_API apilog_ticks apilog_now( void ) {
+    return (apilog_ticks)__rdtsc();
+}
+#elif defined( _WIN32 )
+#include <windows.h>
+#define APILOG_TICKS "ns"
+
+APILOG_API apilog_ticks apilog_now( void ) {
+    static LARGE_INTEGER freq = { 0 };
+    LARGE_INTEGER t;
+    if( freq.QuadPart == 0 )
+        QueryPerformanceFrequency( &freq );
+    QueryPerformanceCounter( &t );
+    return (apilog_ticks)(t.QuadPart / freq.QuadPart) * 1000000000u +
+           (apilog_ticks)(t.QuadPart % freq.QuadPart) * 1000000000u /
+           (apilog_ticks)freq.QuadPart;
+}
+#else
+#include <time.h>
+#define APILOG_TICKS "ns"
+
+#if !defined( CLOCK_MONOTONIC_RAW ) && !defined( CLOCK_MONOTONIC )
+#error "no monotonic clock, define _POSIX_C_SOURCE (or APILOG_RDTSC)"
+#endif
+
+APILOG_API apilog_ticks apilog_now( void ) {
+    struct timespec ts;
+#if defined( CLOCK_MONOTONIC_RAW )
+    clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+#else
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+#endif
+    return (apilog_ticks)ts.tv_sec * 1000000000u + (apilog_ticks)ts.tv_nsec;
+}
+#endif
+
+
+APILOG_API void apilog_max( apilog_ticks volatile* p, apilog_ticks v ) {
+    apilog_ticks old = *p;
+    while( v > old ) {
+#if defined( __GNUC__ )
+        apilog_ticks seen = __sync_val_compare_and_swap( p, old, v );
+        if( seen == old )
+            break;
+        old = seen;
+#else
+        *p = v;
+        break;
+#endif
+    }
+}
+#endif /* APILOG_TIMING */
+
+
+#if defined( APILOG_HISTOGRAM )
+/* Log-linear latency histogram (like HdrHistogram): values below
+ * 2^APILOG_HIST_BITS are counted exactly, larger values are split
+ * into 2^APILOG_HIST_BITS linear sub-buckets per power of two, so
+ * the relative error is at most 2^-APILOG_HIST_BITS. */
+#ifndef APILOG_HIST_BITS
+#define APILOG_HIST_BITS 4
+#endif
+#define APILOG_HIST_SUB (1u << APILOG_HIST_BITS)
+#define APILOG_HIST_BUCKETS ((65 - APILOG_HIST_BITS) * APILOG_HIST_SUB)
+
+typedef struct apilog_hist {
+    unsigned long volatile count[ APILOG_HIST_BUCKETS ];
+    unsigned long volatile n;
+    apilog_ticks volatile max;
+} apilog_hist;
+
+
+APILOG_API unsigned apilog_hist_index( apilog_ticks v ) {
+    unsigned m = 0;
+    if( v < APILOG_HIST_SUB )
+        return (unsigned)v;
+#if defined( __GNUC__ )
+    m = 63 - (unsigned)__builtin_clzll( v );
+#else
+    {
+        apilog_ticks x = v;
+        while( x >>= 1 )
+            ++m;
+    }
+#endif
+    return ((m - APILOG_HIST_BITS + 1) << APILOG_HIST_BITS) |
+           (unsigned)((v >> (m - APILOG_HIST_BITS)) & (APILOG_HIST_SUB-1));
+}
+
+
+/* Returns the largest value that falls into bucket `i`. */
+APILOG_API apilog_ticks apilog_hist_value( unsigned i ) {
+    unsigned m = 0;
+    if( i < APILOG_HIST_SUB )
+        return i;
+    m = (i >> APILOG_HIST_BITS) + APILOG_HIST_BITS - 1;
+    return (((apilog_ticks)(APILOG_HIST_SUB | (i & (APILOG_HIST_SUB-1))) + 1)
+            << (m - APILOG_HIST_BITS)) - 1;
+}
+
+
+APILOG_API void apilog_hist_add( apilog_hist* h, apilog_ticks v ) {
+    APILOG_ADD( h->count[ apilog_hist_index( v ) ], 1 );
+    APILOG_ADD( h->n, 1 );
+    apilog_max( &h->max, v );
+}
+
+
+/* Histograms can be merged by adding up the bucket counts, e.g. to
+ * combine histograms of different threads or call sites. */
+APILOG_API void apilog_hist_merge( apilog_hist* dst, apilog_hist const* src ) {
+    unsigned i = 0;
+    for( i = 0; i < APILOG_HIST_BUCKETS; ++i )
+        dst->count[ i ] += src->count[ i ];
+    dst->n += src->n;
+    if( src->max > dst->max )
+        dst->max = src->max;
+}
+
+
+/* Returns the value below which `permille`/1000 of the samples lie. */
+APILOG_API apilog_ticks apilog_hist_percentile( apilog_hist const* h,
+                                                unsigned permille ) {
+    unsigned long want = (unsigned long)(((apilog_ticks)h->n * permille
+                                          + 999) / 1000);
+    unsigned long seen = 0;
+    unsigned i = 0;
+    if( want == 0 )
+        want = 1;
+    for( i = 0; i < APILOG_HIST_BUCKETS; ++i ) {
+        seen += h->count[ i ];
+        if( seen >= want ) {
+            apilog_ticks v = apilog_hist_value( i );
+            return v < h->max ? v : h->max;
+        }
+    }
+    return h->max;
+}
+#endif /* APILOG_HISTOGRAM */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef APILOG_SITE_BUCKETS
+#define APILOG_SITE_BUCKETS 1024
+#endif
+
+#if defined( APILOG_INTERN_SITES )
+typedef struct apilog_csnode {
+    struct apilog_csnode* next;
+    apilog_callsite cs;
+} apilog_csnode;
+
+static apilog_csnode* apilog_cstab[ APILOG_SITE_BUCKETS ];
+static int volatile apilog_cslock = 0;
+
+
+APILOG_API apilog_callsite const* apilog_callsite_intern( char const* filename,
+                                                          int lineno,
+                                                          char const* api ) {
+    size_t h = (((size_t)filename >> 3) ^ ((size_t)api >> 3) ^
+                ((size_t)lineno * 31u)) % APILOG_SITE_BUCKETS;
+    apilog_csnode* c = NULL;
+    for( c = apilog_cstab[ h ]; c != NULL; c = c->next )
+        if( c->cs.lineno == lineno && c->cs.api == api &&
+            c->cs.filename == filename )
+            return &c->cs;
+    APILOG_LOCK( apilog_cslock );
+    for( c = apilog_cstab[ h ]; c != NULL; c = c->next )
+        if( c->cs.lineno == lineno && c->cs.api == api &&
+            c->cs.filename == filename )
+            break;
+    if( c == NULL && (c = (apilog_csnode*)malloc( sizeof( *c ) )) != NULL ) {
+        c->cs.filename = filename;
+        c->cs.lineno = lineno;
+        c->cs.api = api;
+        c->cs.filter = 0;
+        c->next = apilog_cstab[ h ];
+        APILOG_PUBLISH();
+        apilog_cstab[ h ] = c;
+    }
+    APILOG_UNLOCK( apilog_cslock );
+    return c != NULL ? &c->cs : NULL;
+}
+#endif
+
+
+/* The first logged call from a call site registers it in the site
+ * table, which assigns a small integer id (in order of first use)
+ * and holds all per-call-site state. Sites are keyed by the address
+ * of the descriptor and the name of the traced C function. */
+typedef struct apilog_site {
+    struct apilog_site* next;
+    apilog_callsite const* cs;
+    char const* func;
+    char const* filename;
+    int lineno;
+    char const* api;
+    unsigned id;
+    int flags;
+    int fx;
+    unsigned gen;
+    unsigned long count;
+#if defined( APILOG_PROFILE )
+    apilog_ticks volatile calls;
+    apilog_ticks volatile total;
+    apilog_ticks volatile max;
+#endif
+#if defined( APILOG_HISTOGRAM )
+    apilog_hist hist;
+#endif
+#if defined( APILOG_CALLTREE )
+    apilog_ticks volatile tcalls;
+    apilog_ticks volatile incl;
+    apilog_ticks volatile excl;
+#endif
+#if defined( APILOG_GC )
+    apilog_ticks volatile gcalls;
+    apilog_ticks volatile gcruns;
+    apilog_ticks volatile gctime;
+    apilog_ticks volatile gcmax;
+    apilog_ticks volatile gcfreed;
+#endif
+#if defined( APILOG_PRESIZE )
+    unsigned long ptables;
+    unsigned long parr;
+    unsigned long prec;
+    unsigned long pmaxarr;
+    unsigned long pmaxrec;
+    unsigned long prehash;
+#endif
+#if defined( APILOG_REFS )
+    long rlive;
+    long rpeak;
+    long rbase;
+    long rlow;
+    int rgrowths;
+    unsigned long rmade;
+    unsigned long roldest;
+#endif
+#if defined( APILOG_CHECKS )
+    apilog_ticks volatile ccalls;
+    apilog_ticks volatile ctotal;
+    apilog_ticks volatile cmax;
+#endif
+#if defined( APILOG_COROUTINES )
+    unsigned long volatile threads;
+    unsigned long volatile resumes;
+    unsigned long volatile yields;
+    unsigned long volatile moved;
+    apilog_ticks volatile runtime;
+    apilog_ticks volatile maxrun;
+    apilog_ticks volatile waittime;
+#endif
+#if defined( APILOG_BUFSTATS )
+    unsigned long volatile builds;
+    unsigned long volatile grows;
+    unsigned long volatile bsize;
+    unsigned long volatile bmax;
+    unsigned long volatile copied;
+#endif
+#if defined( APILOG_ALLOC )
+    unsigned long volatile nallocs;
+    unsigned long volatile nfrees;
+    unsigned long volatile abytes;
+    unsigned long volatile fbytes;
+#endif
+} apilog_site;
+
+#define APILOG_SITE_DEFINED 1
+#define APILOG_SITE_EFFECT 2
+#define APILOG_SITE_ENABLED 4
+#define APILOG_SITE_CHECK 8
+
+static apilog_site* apilog_sitetab[ APILOG_SITE_BUCKETS ];
+static unsigned apilog_nsites = 0;
+static int volatile apilog_sitelock = 0;
+
+
+APILOG_API apilog_site* apilog_site_get( apilog_callsite const* cs,
+                                         char const* func ) {
+    size_t h = ((size_t)cs >> 3) % APILOG_SITE_BUCKETS;
+    apilog_site* s = NULL;
+    for( s = apilog_sitetab[ h ]; s != NULL; s = s->next )
+        if( s->cs == cs && s->func == func )
+            return s;
+    APILOG_LOCK( apilog_sitelock );
+    for( s = apilog_sitetab[ h ]; s != NULL; s = s->next )
+        if( s->cs == cs && s->func == func )
+            break;
+    if( s == NULL && (s = (apilog_site*)calloc( 1, sizeof( *s ) )) != NULL ) {
+        s->cs = cs;
+        s->func = func;
+        s->filename = cs->filename;
+        s->lineno = cs->lineno;
+        s->api = cs->api;
+        s->id = apilog_nsites++;
+        s->flags = 0;
+        s->fx = 0;
+        s->gen = 0;
+        s->count = 0;
+#if defined( APILOG_PROFILE )
+        s->calls = 0;
+        s->total = 0;
+        s->max = 0;
+#endif
+#if defined( APILOG_HISTOGRAM )
+        memset( &s->hist, 0, sizeof( s->hist ) );
+#endif
+#if defined( APILOG_CHECKS )
+        if( !strncmp( s->api, "luaL_check", 10 ) ||
+            !strncmp( s->api, "luaL_opt", 8 ) ||
+            !strcmp( s->api, "luaL_testudata" ) )
+            s->flags |= APILOG_SITE_CHECK;
+#endif
+        s->next = apilog_sitetab[ h ];
+        APILOG_PUBLISH();
+        apilog_sitetab[ h ] = s;
+    }
+    APILOG_UNLOCK( apilog_sitelock );
+    return s;
+}
+
+
+/* Returns the id of a call site (or -1 if it hasn't been used yet). */
+APILOG_API long apilog_site_id( apilog_callsite const* cs,
+                                char const* func ) {
+    size_t h = ((size_t)cs >> 3) % APILOG_SITE_BUCKETS;
+    apilog_site* s = NULL;
+    for( s = apilog_sitetab[ h ]; s != NULL; s = s->next )
+        if( s->cs == cs && s->func == func )
+            return (long)s->id;
+    return -1;
+}
+
+
+/* Returns a new array of all call sites for which `keep()` is true
+ * (plus `extra` if not NULL) sorted by `cmp()`, or NULL. The number
+ * of entries goes to `*n`. */
+APILOG_API apilog_site** apilog_site_list( int (*keep)( apilog_site const* ),
+                                           int (*cmp)( void const*,
+                                                       void const* ),
+                                           apilog_site* extra,
+                                           size_t* n ) {
+    apilog_site** sites = NULL;
+    size_t i = 0;
+    *n = 0;
+    APILOG_LOCK( apilog_sitelock );
+    sites = (apilog_site**)malloc( (apilog_nsites+2) * sizeof( *sites ) );
+    if( sites != NULL ) {
+        for( i = 0; i < APILOG_SITE_BUCKETS; ++i ) {
+            apilog_site* s = apilog_sitetab[ i ];
+            for( ; s != NULL; s = s->next )
+                if( keep( s ) )
+                    sites[ (*n)++ ] = s;
+        }
+        if( extra != NULL )
+            sites[ (*n)++ ] = extra;
+    }
+    APILOG_UNLOCK( apilog_sitelock );
+    if( sites != NULL )
+        qsort( sites, *n, sizeof( *sites ), cmp );
+    return sites;
+}
+
+
+/* Writes one line per call site for which `keep()` is true in the
+ * order given by `cmp()`. `row()` writes the column headers when it
+ * gets NULL instead of a call site. */
+APILOG_API void apilog_site_report( FILE* out,
+                                    int (*keep)( apilog_site const* ),
+                                    int (*cmp)( void const*, void const* ),
+                                    void (*row)( FILE*, apilog_site const* ) ) {
+    size_t n = 0;
+    size_t i = 0;
+    apilog_site** sites = apilog_site_list( keep, cmp, NULL, &n );
+    if( sites == NULL )
+        return;
+    row( out, NULL );
+    for( i = 0; i < n; ++i )
+        row( out, sites[ i ] );
+    free( sites );
+}
+
+
+static int volatile apilog_exitlock = 0;
+
+/* Registers `f` with `atexit()` unless `*done` says that this has
+ * happened already. */
+APILOG_API void apilog_atexit_once( int* done, void (*f)( void ) ) {
+    if( !*done ) {
+        APILOG_LOCK( apilog_exitlock );
+        if( !*done ) {
+            atexit( f );
+            *done = 1;
+        }
+        APILOG_UNLOCK( apilog_exitlock );
+    }
+}
+
+
+#if defined( APILOG_FILTER )
+#include <stdlib.h>
+#include <string.h>
+
+/* Runtime filter, set from the environment variable APILOG_FILTER or
+ * by calling `apilog_filter()`. The filter is evaluated only once per
+ * call site (and again after the filter has changed). */
+static char* apilog_filterspec = NULL;
+static unsigned volatile apilog_filtergen = 0;
+static int volatile apilog_filterlock = 0;
+
+/* A call site descriptor remembers the filter generation for which
+ * its call site has been rejected, so that filtered out API calls
+ * don't need to look up their site. This assumes that a descriptor
+ * is only used from one C function. */
+#define APILOG_FILTERED( cs ) \
+    ((cs)->filter == ((apilog_filtergen << 1) | 1u))
+
+
+/* Checks whether `value` is accepted by the `kind:value` entries of
+ * the given kind in the filter specification. No entries of a kind
+ * accept everything. With `path` set, the entry may also match the
+ * last path components of `value`. */
+APILOG_API int apilog_filter_match( char const* spec,
+                                    char const* kind,
+                                    char const* value,
+                                    int path ) {
+    size_t klen = strlen( kind );
+    size_t vlen = strlen( value );
+    int seen = 0;
+    while( spec != NULL && *spec != '\0' ) {
+        char const* e = strchr( spec, ',' );
+        size_t n = e != NULL ? (size_t)(e - spec) : strlen( spec );
+        if( n > klen && spec[ klen ] == ':' &&
+            memcmp( spec, kind, klen ) == 0 ) {
+            char const* v = spec + klen + 1;
+            size_t m = n - klen - 1;
+            seen = 1;
+            if( m == vlen && memcmp( v, value, m ) == 0 )
+                return 1;
+            if( path && m < vlen && memcmp( value+vlen-m, v, m ) == 0 &&
+                (value[ vlen-m-1 ] == '/' || value[ vlen-m-1 ] == '\\') )
+                return 1;
+        }
+        spec = e != NULL ? e+1 : NULL;
+    }
+    return !seen;
+}
+
+
+/* Sets a new runtime filter. The specification is a comma-separated
+ * list of `api:<name>`, `func:<name>`, and `file:<name>` entries.
+ * Entries of the same kind are alternatives, and all kinds must
+ * match. NULL or an empty string enable everything. Returns 0 on
+ * success, -1 if out of memory. */
+APILOG_API int apilog_filter( char const* spec ) {
+    char* copy = NULL;
+    if( spec != NULL && *spec != '\0' ) {
+        copy = (char*)malloc( strlen( spec )+1 );
+        if( copy == NULL )
+            return -1;
+        strcpy( copy, spec );
+    }
+    APILOG_LOCK( apilog_filterlock );
+    free( apilog_filterspec );
+    apilog_filterspec = copy;
+    if( ++apilog_filtergen == 0 )
+        apilog_filtergen = 1;
+    APILOG_UNLOCK( apilog_filterlock );
+    return 0;
+}
+
+
+APILOG_API int apilog_filter_site( apilog_site* site ) {
+    if( apilog_filtergen == 0 )
+        apilog_filter( getenv( "APILOG_FILTER" ) );
+    if( site->gen != apilog_filtergen ) {
+        APILOG_LOCK( apilog_filterlock );
+        if( apilog_filter_match( apilog_filterspec, "api", site->api, 0 ) &&
+            apilog_filter_match( apilog_filterspec, "func", site->func, 0 ) &&
+            apilog_filter_match( apilog_filterspec, "file", site->filename, 1 ) )
+            site->flags |= APILOG_SITE_ENABLED;
+        else
+            site->flags &= ~APILOG_SITE_ENABLED;
+        site->gen = apilog_filtergen;
+        ((apilog_callsite*)site->cs)->filter = (site->gen << 1) |
+            ((site->flags & APILOG_SITE_ENABLED) ? 0u : 1u);
+        APILOG_UNLOCK( apilog_filterlock );
+    }
+    return (site->flags & APILOG_SITE_ENABLED) != 0;
+}
+#endif /* APILOG_FILTER */
+
+
+#if defined( APILOG_SAMPLE )
+/* Only every APILOG_SAMPLE-th call of a call site is logged (or, with
+ * APILOG_SAMPLE_RANDOM, every call with a probability of
+ * 1/APILOG_SAMPLE). The counters are not synchronized, so with
+ * multiple threads the numbers are only approximate. */
+static unsigned long apilog_samplerate = APILOG_SAMPLE;
+#if defined( APILOG_SAMPLE_RANDOM )
+static APILOG_TLS unsigned long apilog_random = 0;
+#endif
+
+
+/* Changes the sampling rate at runtime. */
+APILOG_API void apilog_sample( unsigned long n ) {
+    apilog_samplerate = n > 0 ? n : 1;
+}
+
+
+APILOG_API unsigned long apilog_sample_site( apilog_site* site ) {
+    unsigned long n = ++site->count;
+#if defined( APILOG_SAMPLE_RANDOM )
+    unsigned long x = apilog_random;
+    if( x == 0 )
+        x = ((unsigned long)(size_t)&apilog_random >> 4) | 1u;
+    x ^= (x << 13) & 0xFFFFFFFFul;
+    x ^= x >> 17;
+    x ^= (x << 5) & 0xFFFFFFFFul;
+    apilog_random = x;
+    if( x % apilog_samplerate != 0 )
+        return 0;
+#else
+    if( n < apilog_samplerate )
+        return 0;
+#endif
+    site->count = 0;
+    return n;
+}
+#endif /* APILOG_SAMPLE */
+
+
+#if defined( APILOG_FILTER ) || defined( APILOG_SAMPLE )
+/* Returns the number of API calls that the log line for the current
+ * call represents (1 plus the number of skipped calls), or 0 if this
+ * call shouldn't be logged. */
+APILOG_API unsigned long apilog_enabled( apilog_site* site ) {
+#if defined( APILOG_FILTER )
+    if( !apilog_filter_site( site ) )
+        return 0;
+#endif
+#if defined( APILOG_SAMPLE )
+    return apilog_sample_site( site );
+#else
+    return 1;
+#endif
+}
+#define APILOG_ENABLED( site ) apilog_enabled( site )
+#else
+#define APILOG_ENABLED( site ) 1
+#endif
+
+
+/* Formats `i` into the characters before `end` and returns a pointer
+ * to the first digit. */
+APILOG_API char* apilog_fmtint( char* end, long i ) {
+    unsigned long u = i < 0 ? 0ul - (unsigned long)i : (unsigned long)i;
+    do {
+        *--end = (char)('0' + u % 10);
+        u /= 10;
+    } while( u > 0 );
+    if( i < 0 )
+        *--end = '-';
+    return end;
+}
+
+
+#if defined( APILOG_STATES )
+#include <stdlib.h>
+
+#ifndef APILOG_STATE_BUCKETS
+#define APILOG_STATE_BUCKETS 256
+#endif
+
+#if defined( APILOG_RECORDER )
+#ifndef APILOG_RECORDER_SIZE
+#define APILOG_RECORDER_SIZE 64
+#endif
+#if (APILOG_RECORDER_SIZE & (APILOG_RECORDER_SIZE-1)) != 0
+#error "APILOG_RECORDER_SIZE must be a power of two"
+#endif
+
+typedef struct apilog_rec {
+    apilog_site* site;
+    int top;
+} apilog_rec;
+#endif
+
+#if defined( APILOG_CALLTREE )
+/* A node in the call tree represents a call site together with the
+ * call sites of all active calls below it (on the same `lua_State`). */
+typedef struct apilog_node {
+    struct apilog_node* next; /* sibling */
+    struct apilog_node* children;
+    struct apilog_node* parent;
+    apilog_site* site;
+    apilog_ticks volatile calls;
+    apilog_ticks volatile incl;
+    apilog_ticks volatile excl;
+} apilog_node;
+
+typedef struct apilog_sframe {
+    apilog_node* node;
+    apilog_ticks child; /* time spent in nested calls */
+    void const* sp; /* the `apilog_frame` of the wrapper */
+} apilog_sframe;
+#endif
+
+/* Per `lua_State` information: the function and stack snapshot of
+ * the last logged API call. Coroutines have their own entries. */
+typedef struct apilog_state {
+    struct apilog_state* next;
+    lua_State* L;
+    char const* func;
+    int top;
+    int cap;
+    unsigned count;
+    unsigned char* types;
+#if defined( APILOG_DIFF )
+    unsigned long skips; /* `apilog_skips` at the last logged line */
+#endif
+#if defined( APILOG_RECORDER )
+    unsigned long nrecs;
+    apilog_rec recs[ APILOG_RECORDER_SIZE ];
+#endif
+#if defined( APILOG_COROUTINES )
+    lua_State* parent; /* creator or last resumer */
+    apilog_site* origin; /* `lua_newthread()` call site */
+    apilog_ticks resumed;
+    apilog_ticks suspended;
+#endif
+#if defined( APILOG_CALLTREE )
+    struct apilog_sframe* frames; /* shadow call stack */
+    int depth;
+    int fcap;
+#endif
+#if defined( APILOG_SUMMARY )
+    char const* rfunc; /* function of the current run */
+    char const* rfile;
+    unsigned long rcalls;
+    int rbase;
+    int rtop;
+    int rpeak;
+#endif
+} apilog_state;
+
+static apilog_state* apilog_statetab[ APILOG_STATE_BUCKETS ];
+static int volatile apilog_statelock = 0;
+
+#if defined( APILOG_EXTRASPACE )
+/* The first pointer in the extra space of a `lua_State` caches its
+ * entry. New coroutines inherit the pointer of the main state, so it
+ * must be checked before use. */
+#define APILOG_XSPACE( L ) (*(apilog_state**)lua_getextraspace( L ))
+#endif
+
+
+APILOG_API apilog_state* apilog_state_get( lua_State* L ) {
+    size_t h = ((size_t)L >> 4) % APILOG_STATE_BUCKETS;
+    apilog_state* s = NULL;
+#if defined( APILOG_XSPACE )
+    s = APILOG_XSPACE( L );
+    if( s != NULL && s->L == L )
+        return s;
+#endif
+    for( s = apilog_statetab[ h ]; s != NULL; s = s->next )
+        if( s->L == L )
+            break;
+    if( s == NULL ) {
+        APILOG_LOCK( apilog_statelock );
+        for( s = apilog_statetab[ h ]; s != NULL; s = s->next )
+            if( s->L == L )
+                break;
+        if( s == NULL &&
+            (s = (apilog_state*)calloc( 1, sizeof( *s ) )) != NULL ) {
+            s->L = L;
+            s->next = apilog_statetab[ h ];
+            APILOG_PUBLISH();
+            apilog_statetab[ h ] = s;
+        }
+        APILOG_UNLOCK( apilog_statelock );
+    }
+#if defined( APILOG_XSPACE )
+    APILOG_XSPACE( L ) = s;
+#endif
+    return s;
+}
+
+
+#if defined( APILOG_XSPACE )
+APILOG_API lua_State* apilog_xspace_init( lua_State* L ) {
+    if( L != NULL )
+        APILOG_XSPACE( L ) = NULL;
+    return L;
+}
+#endif
+
+
+/* Makes room for a snapshot of `top` stack slots (indices 1..top). */
+APILOG_API int apilog_state_reserve( apilog_state* s, int top ) {
+    if( top >= s->cap ) {
+        int cap = s->cap > 0 ? 2*s->cap : 64;
+        unsigned char* types = NULL;
+        while( cap <= top )
+            cap *= 2;
+        types = (unsigned char*)realloc( s->types, (size_t)cap );
+        if( types == NULL )
+            return -1;
+        s->types = types;
+        s->cap = cap;
+    }
+    return 0;
+}
+#endif /* APILOG_STATES */
+
+#if defined( APILOG_RECORDER )
+#include <signal.h>
+#if defined( _WIN32 )
+#include <io.h>
+#define APILOG_DUMP( p, n ) ((void)_write( 2, (p), (unsigned)(n) ))
+#else
+#include <unistd.h>
+#define APILOG_DUMP( p, n ) \
+    do { if( write( 2, (p), (n) ) < 0 ) break; } while( 0 )
+#endif
+
+/* The flight recorder keeps the last APILOG_RECORDER_SIZE API calls
+ * of every `lua_State` in a ring buffer (site and stack top only, no
+ * formatting). The rings are dumped to `stderr` when the program
+ * crashes with a fatal signal or when Lua panics. */
+static int volatile apilog_reclock = 0;
+static int volatile apilog_crashed = 0;
+static int apilog_hooked = 0;
+/* the state of the last recorded API call on this thread */
+static APILOG_TLS apilog_state* apilog_recstate = NULL;
+
+/* The original panic functions of all Lua universes seen so far. The
+ * registry identifies the universe. Entries are never removed, so
+ * the panic function can search the list without locking. */
+typedef struct apilog_universe {
+    struct apilog_universe* next;
+    void const* registry;
+    lua_CFunction panic;
+} apilog_universe;
+
+static apilog_universe* volatile apilog_universes = NULL;
+static void (*apilog_oldsig[ 3 ])( int );
+static int const apilog_signals[ 3 ] = {
+    SIGSEGV,
+    SIGABRT,
+#if defined( SIGBUS )
+    SIGBUS
+#else
+    SIGILL
+#endif
+};
+
+
+/* Writes the recorded API calls of all `lua_State`s to `stderr`.
+ * Only uses async-signal-safe functions. */
+APILOG_API void apilog_dump( void ) {
+    size_t h = 0;
+    for( h = 0; h < APILOG_STATE_BUCKETS; ++h ) {
+        apilog_state* s = NULL;
+        for( s = apilog_statetab[ h ]; s != NULL; s = s->next ) {
+            unsigned long n = s->nrecs;
+            unsigned long i = n > APILOG_RECORDER_SIZE ?
+                n - APILOG_RECORDER_SIZE : 0;
+            char line[ 64 ];
+            char* p = line + sizeof( line );
+            size_t a = (size_t)s->L;
+            if( n == 0 )
+                continue;
+            *--p = '\n';
+            *--p = ':';
+            do {
+                *--p = "0123456789abcdef"[ a % 16 ];
+                a /= 16;
+            } while( a > 0 );
+            APILOG_DUMP( "apilog: last API calls on lua_State 0x", 38 );
+            APILOG_DUMP( p, (size_t)(line + sizeof( line ) - p) );
+            for( ; i < n; ++i ) {
+                apilog_rec const* r = s->recs + (i & (APILOG_RECORDER_SIZE-1));
+                apilog_site const* site = r->site;
+                if( site == NULL )
+                    continue;
+                APILOG_DUMP( "  ", 2 );
+                APILOG_DUMP( site->api, strlen( site->api ) );
+                APILOG_DUMP( " in ", 4 );
+                APILOG_DUMP( site->func, strlen( site->func ) );
+                APILOG_DUMP( "@", 1 );
+                APILOG_DUMP( site->filename, strlen( site->filename ) );
+                p = line + sizeof( line );
+                *--p = '\n';
+                p = apilog_fmtint( p, r->top );
+                p -= 7;
+                memcpy( p, ":  top=", 7 );
+                p = apilog_fmtint( p, site->lineno );
+                *--p = ':';
+                APILOG_DUMP( p, (size_t)(line + sizeof( line ) - p) );
+            }
+        }
+    }
+}
+
+
+APILOG_API void apilog_crash( void ) {
+    if( !apilog_crashed ) {
+        apilog_crashed = 1;
+        apilog_dump();
+    }
+}
+
+
+static void apilog_signal( int sig ) {
+    int i = 0;
+    apilog_crash();
+    for( i = 0; i < 3; ++i )
+        if( apilog_signals[ i ] == sig )
+            signal( sig, apilog_oldsig[ i ] );
+    raise( sig );
+}
+
+
+/* Doesn't allocate, the panic might be caused by a memory error. */
+static int apilog_panic( lua_State* L ) {
+    void const* r = lua_topointer( L, LUA_REGISTRYINDEX );
+    apilog_universe* u = NULL;
+    apilog_crash();
+    for( u = apilog_universes; u != NULL; u = u->next )
+        if( u->registry == r )
+            break;
+    if( u != NULL && u->panic != 0 )
+        return u->panic( L );
+    abort();
+    return 0;
+}
+
+
+/* Installs the signal handlers (once) and the panic function of the
+ * Lua universe that `L` belongs to. The original panic function is
+ * called after the dump. */
+APILOG_API void apilog_recorder_init( lua_State* L ) {
+    lua_CFunction old = lua_atpanic( L, apilog_panic );
+    void const* r = lua_topointer( L, LUA_REGISTRYINDEX );
+    apilog_universe* u = NULL;
+    APILOG_LOCK( apilog_reclock );
+    if( old != apilog_panic ) {
+        /* reuses the entry of a closed universe at the same address */
+        for( u = apilog_universes; u != NULL; u = u->next )
+            if( u->registry == r )
+                break;
+        if( u != NULL )
+            u->panic = old;
+        else if( (u = (apilog_universe*)malloc( sizeof( *u ) )) != NULL ) {
+            u->registry = r;
+            u->panic = old;
+            u->next = apilog_universes;
+            APILOG_PUBLISH();
+            apilog_universes = u;
+        }
+    }
+    if( !apilog_hooked ) {
+        int i = 0;
+        apilog_hooked = 1;
+        for( i = 0; i < 3; ++i )
+            apilog_oldsig[ i ] = signal( apilog_signals[ i ], apilog_signal );
+    }
+    APILOG_UNLOCK( apilog_reclock );
+}
+
+
+/* A couple of stores per API call. */
+APILOG_API void apilog_record( lua_State* L, apilog_site* site ) {
+    apilog_state* s = apilog_recstate;
+    if( s == NULL || s->L != L )
+        apilog_recstate = s = apilog_state_get( L );
+    if( s != NULL ) {
+        apilog_rec* r = s->recs + (s->nrecs & (APILOG_RECORDER_SIZE-1));
+        if( s->nrecs == 0 )
+            apilog_recorder_init( L );
+        r->site = site;
+        r->top = lua_gettop( L );
+        s->nrecs++;
+    }
+}
+#endif /* APILOG_RECORDER */
+
+#if defined( APILOG_PRINT )
+/* A custom `apilog_print( L, func, filename, lineno, api )` has been
+ * defined before including this file. It is called for every logged
+ * API call. */
+#define APILOG_EMIT( L, site, weight ) \
+    ((weight) > 0 ? apilog_print( (L), (site)->func, (site)->filename, \
+                                  (site)->lineno, (site)->api ) : (void)0)
+#else
+#define APILOG_PRINT
+#define APILOG_EMIT( L, site, weight ) apilog_emit( (L), (site), (weight) )
+#include <stdio.h>
+
+#if defined( APILOG_QUIET )
+
+/* No per-call output, e.g. when only the profiler is needed. */
+APILOG_API void apilog_emit( lua_State* L,
+                             apilog_site* site,
+                             unsigned long weight ) {
+    (void)L;
+    (void)site;
+    (void)weight;
+}
+
+#elif defined( APILOG_BINARY )
+#include <time.h>
+
+#ifndef APILOG_BINARY_FILE
+#define APILOG_BINARY_FILE "apilog.bin"
+#endif
+
+#ifndef APILOG_BUFFER_SIZE
+#define APILOG_BUFFER_SIZE 262144
+#endif
+
+#if APILOG_BUFFER_SIZE < 16384
+#error "APILOG_BUFFER_SIZE is too small"
+#endif
+
+static struct {
+    FILE* f;
+    size_t n;
+    unsigned long stamp;
+    int registered;
+    int volatile lock;
+    unsigned char data[ APILOG_BUFFER_SIZE ];
+} apilog_bin = { NULL, APILOG_BLOCKHEAD, 0, 0, 0, { 0 } };
+
+
+/* Must be called with `apilog_bin.lock` held. */
+APILOG_API void apilog_bin_flush( void ) {
+    if( apilog_bin.n > APILOG_BLOCKHEAD ) {
+        if( apilog_bin.f == NULL ) {
+            apilog_bin.f = fopen( APILOG_BINARY_FILE, "ab" );
+            if( apilog_bin.f != NULL )
+                setvbuf( apilog_bin.f, NULL, _IONBF, 0 );
+        }
+        if( apilog_bin.f != NULL ) {
+            memcpy( apilog_bin.data, "ALG1", 4 );
+            apilog_put32( apilog_bin.data+4, (unsigned long)(size_t)&apilog_bin );
+            apilog_put32( apilog_bin.data+8, apilog_bin.stamp );
+            apilog_put32( apilog_bin.data+12, apilog_bin.n-APILOG_BLOCKHEAD );
+            fwrite( apilog_bin.data, 1, apilog_bin.n, apilog_bin.f );
+        }
+    }
+    apilog_bin.n = APILOG_BLOCKHEAD;
+}
+
+
+/* Writes all buffered records to the trace file. This also happens
+ * automatically when the buffer is full and at program exit. */
+APILOG_API void apilog_flush( void ) {
+    APILOG_LOCK( apilog_bin.lock );
+    apilog_bin_flush();
+    APILOG_UNLOCK( apilog_bin.lock );
+}
+
+
+/* Must be called with `apilog_bin.lock` held. */
+/* Packs `n` type codes into 4-bit nibbles (low nibble first), eight
+ * codes per 32-bit word. */
+APILOG_API unsigned char* apilog_pack( unsigned char* p,
+                                       unsigned char const* codes,
+                                       int n ) {
+    int i = 0;
+    for( ; i+8 <= n; i += 8, p += 4 )
+        apilog_put32( p, (unsigned long)codes[ i ] |
+                         ((unsigned long)codes[ i+1 ] << 4) |
+                         ((unsigned long)codes[ i+2 ] << 8) |
+                         ((unsigned long)codes[ i+3 ] << 12) |
+                         ((unsigned long)codes[ i+4 ] << 16) |
+                         ((unsigned long)codes[ i+5 ] << 20) |
+                         ((unsigned long)codes[ i+6 ] << 24) |
+                         ((unsigned long)codes[ i+7 ] << 28) );
+    for( ; i < n; i += 2 ) {
+        int code = codes[ i ];
+        if( i+1 < n )
+            code |= codes[ i+1 ] << 4;
+        *p++ = (unsigned char)code;
+    }
+    return p;
+}
+
+
+APILOG_API void apilog_bin_site( apilog_site* site ) {
+    size_t apilen = strlen( site->api );
+    size_t funclen = strlen( site->func );
+    size_t filelen = strlen( site->filename );
+    unsigned char* p = NULL;
+    if( apilen > APILOG_MAXNAME ) apilen = APILOG_MAXNAME;
+    if( funclen > APILOG_MAXNAME ) funclen = APILOG_MAXNAME;
+    if( filelen > APILOG_MAXNAME ) filelen = APILOG_MAXNAME;
+    if( apilog_bin.n + APILOG_SITEHEAD + apilen + funclen + filelen >
+        APILOG_BUFFER_SIZE )
+        apilog_bin_flush();
+    p = apilog_bin.data + apilog_bin.n;
+    memcpy( p, "S\0\0\0", 4 );
+    apilog_put32( p+4, site->id );
+    apilog_put32( p+8, (unsigned long)site->lineno );
+    apilog_put16( p+12, (unsigned)apilen );
+    apilog_put16( p+14, (unsigned)funclen );
+    apilog_put16( p+16, (unsigned)filelen );
+    apilog_put16( p+18, 0 );
+    p += APILOG_SITEHEAD;
+    memcpy( p, site->api, apilen );
+    memcpy( p+apilen, site->func, funclen );
+    memcpy( p+apilen+funclen, site->filename, filelen );
+    apilog_bin.n += APILOG_SITEHEAD + apilen + funclen + filelen;
+    site->flags |= APILOG_SITE_DEFINED;
+}
+
+
+APILOG_API void apilog_emit( lua_State* L,
+                             apilog_site* site,
+                             unsigned long weight ) {
+    if( weight > 0 ) {
+        int top = lua_gettop( L );
+        int n = top;
+        int i = 0;
+        unsigned char* p = NULL;
+        if( n > 2*(APILOG_BUFFER_SIZE-APILOG_BLOCKHEAD-APILOG_CALLHEAD) )
+            n = 2*(APILOG_BUFFER_SIZE-APILOG_BLOCKHEAD-APILOG_CALLHEAD);
+        APILOG_LOCK( apilog_bin.lock );
+        if( !apilog_bin.registered ) {
+            apilog_bin.registered = 1;
+            apilog_bin.stamp = (unsigned long)time( NULL );
+            atexit( apilog_flush );
+        }
+        if( !(site->flags & APILOG_SITE_DEFINED) )
+            apilog_bin_site( site );
+        if( apilog_bin.n + APILOG_CALLHEAD + (n+1)/2 > APILOG_BUFFER_SIZE )
+            apilog_bin_flush();
+        p = apilog_bin.data + apilog_bin.n;
+        if( --weight > 0xFFFFFFul )
+            weight = 0xFFFFFFul;
+        p[ 0 ] = 'C';
+        p[ 1 ] = (unsigned char)(weight & 0xFF);
+        p[ 2 ] = (unsigned char)((weight >> 8) & 0xFF);
+        p[ 3 ] = (unsigned char)((weight >> 16) & 0xFF);
+        apilog_put32( p+4, site->id );
+        apilog_put32( p+8, (unsigned long)top );
+        apilog_put32( p+12, (unsigned long)n );
+        p += APILOG_CALLHEAD;
+        for( i = 1; i <= n; i += APILOG_CHUNK ) {
+            unsigned char codes[ APILOG_CHUNK ];
+            int m = n-i+1 < APILOG_CHUNK ? n-i+1 : APILOG_CHUNK;
+            apilog_snapshot( L, i, m, codes );
+            p = apilog_pack( p, codes, m );
+        }
+        apilog_bin.n = (size_t)(p - apilog_bin.data);
+        APILOG_UNLOCK( apilog_bin.lock );
+    }
+}
+
+#else /* text output */
+
+#if defined( APILOG_BUFFERED )
+#include <stdlib.h>
+#include <string.h>
+#if defined( _WIN32 )
+#include <io.h>
+#define APILOG_WRITE( p, n ) _write( 2, (p), (unsigned)(n) )
+#elif defined( APILOG_MMAP )
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#define APILOG_WRITE( p, n ) apilog_mmap_write( (p), (n) )
+#else
+#include <unistd.h>
+#define APILOG_WRITE( p, n ) write( 2, (p), (n) )
+#endif
+
+#ifndef APILOG_BUFFER_SIZE
+#define APILOG_BUFFER_SIZE 65536
+#endif
+#if APILOG_BUFFER_SIZE < 1024
+#error "APILOG_BUFFER_SIZE is too small"
+#endif
+
+#if defined( APILOG_ASYNC ) || defined( APILOG_MMAP )
+#undef APILOG_BATCH
+#define APILOG_BATCH 1
+#endif
+
+#ifndef APILOG_BATCH
+#define APILOG_BATCH 1
+#endif
+
+#if defined( APILOG_ASYNC )
+#ifndef APILOG_QUEUE_SIZE
+#define APILOG_QUEUE_SIZE 1048576
+#endif
+#if (APILOG_QUEUE_SIZE & (APILOG_QUEUE_SIZE-1)) != 0 || \
+    APILOG_QUEUE_SIZE < APILOG_BUFFER_SIZE
+#error "APILOG_QUEUE_SIZE must be a power of two >= APILOG_BUFFER_SIZE"
+#endif
+#if defined( _WIN32 )
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#endif
+/* Only the owning thread touches its buffer, the queue is lock-free */
+#define APILOG_TBUF_LOCK( b ) ((void)0)
+#define APILOG_TBUF_UNLOCK( b ) ((void)0)
+#else
+#define APILOG_TBUF_LOCK( b ) APILOG_LOCK( (b)->lock )
+#define APILOG_TBUF_UNLOCK( b ) APILOG_UNLOCK( (b)->lock )
+#endif
+
+/* Every thread formats its log lines into its own buffer, which is
+ * written to `stderr` with a single system call after APILOG_BATCH
+ * records. The buffers are never freed so that they can still be
+ * flushed at program exit.
+ * With APILOG_ASYNC every record is instead copied into a
+ * single-producer/single-consumer ring buffer of the thread, and a
+ * background thread writes the contents of all ring buffers to
+ * `stderr`. If a ring buffer is full, the record is dropped (and
+ * counted), or, with APILOG_ASYNC_BLOCK, the thread spins until the
+ * background thread has made room. When a thread exits (POSIX only),
+ * the background thread removes its buffer from the list after the
+ * last records have been written, and keeps it for reuse by the next
+ * new thread. */
+typedef struct apilog_tbuf {
+    struct apilog_tbuf* next;
+    size_t n;
+    int count;
+    int volatile lock;
+#if defined( APILOG_ASYNC )
+    size_t volatile head; /* written by the owning thread */
+    size_t volatile tail; /* written by the background thread */
+    unsigned long volatile dropped;
+    unsigned long reported;
+    int volatile retired; /* set when the owning thread has exited */
+    struct apilog_tbuf* nextfree;
+    char queue[ APILOG_QUEUE_SIZE ];
+#endif
+    char data[ APILOG_BUFFER_SIZE ];
+} apilog_tbuf;
+
+static apilog_tbuf* volatile apilog_tbufs = NULL;
+static int volatile apilog_tbuflock = 0;
+static int apilog_tbufinit = 0;
+static APILOG_TLS apilog_tbuf* apilog_mytbuf = NULL;
+#if defined( APILOG_ASYNC )
+static apilog_tbuf* apilog_freetbufs = NULL; /* for reuse */
+static unsigned long volatile apilog_freedropped = 0;
+#if !defined( _WIN32 )
+static pthread_key_t apilog_tbufkey;
+#endif
+#endif
+
+
+#if defined( APILOG_MMAP )
+#ifndef APILOG_MMAP_FILE
+#define APILOG_MMAP_FILE "apilog.log"
+#endif
+#ifndef APILOG_SEGMENT_SIZE
+#define APILOG_SEGMENT_SIZE 67108864
+#endif
+#ifndef APILOG_MMAP_LIMIT
+#define APILOG_MMAP_LIMIT 1073741824
+#endif
+#if APILOG_SEGMENT_SIZE < APILOG_BUFFER_SIZE
+#error "APILOG_SEGMENT_SIZE must be at least APILOG_BUFFER_SIZE"
+#endif
+
+/* The log lines are written into a memory mapped file of
+ * APILOG_SEGMENT_SIZE bytes that is allocated up front. Writers
+ * reserve their bytes with an atomic add on the offset and write
+ * them without holding a lock; `users` counts the writers that are
+ * still busy with the current segment. When a segment is full, it is
+ * truncated to its used size and the next segment (`apilog.log.0`,
+ * `apilog.log.1`, ...) is started. Only the newest APILOG_MMAP_LIMIT
+ * bytes worth of segments are kept on disk. If a segment can't be
+ * created, the output goes to `stderr` instead. */
+static struct {
+    char* volatile base;
+    size_t volatile n;
+    size_t used; /* offset of the first reservation that didn't fit */
+    int volatile users;
+    unsigned long seq;
+    int fd;
+    int registered;
+    int volatile lock;
+} apilog_mm = { NULL, 0, 0, 0, 0, -1, 0, 0 };
+
+
+/* Truncates the current segment to the bytes actually written. Runs
+ * at program exit after all buffers have been flushed. */
+APILOG_API void apilog_mmap_close( void );
+
+
+/* Must be called with `apilog_mm.lock` held. */
+APILOG_API void apilog_mmap_register( void ) {
+    if( !apilog_mm.registered ) {
+        apilog_mm.registered = 1;
+        atexit( apilog_mmap_close );
+    }
+}
+
+
+/* Must be called with `apilog_mm.lock` held. */
+APILOG_API void apilog_mmap_close_segment( void ) {
+    if( apilog_mm.base != NULL ) {
+        char* base = apilog_mm.base;
+        size_t n = 0;
+        apilog_mm.base = NULL;
+        __sync_synchronize();
+        while( apilog_mm.users > 0 ) {}
+        n = apilog_mm.n <= APILOG_SEGMENT_SIZE ? apilog_mm.n : apilog_mm.used;
+        munmap( base, APILOG_SEGMENT_SIZE );
+        if( ftruncate( apilog_mm.fd, (off_t)n ) != 0 ) {
+            /* keeps the trailing NUL bytes */
+        }
+        close( apilog_mm.fd );
+        apilog_mm.fd = -1;
+        apilog_mm.seq++;
+    }
+}
+
+
+/* Must be called with `apilog_mm.lock` held. */
+APILOG_API void apilog_mmap_open_segment( void ) {
+    unsigned long keep = APILOG_MMAP_LIMIT / APILOG_SEGMENT_SIZE;
+    char name[ sizeof( APILOG_MMAP_FILE )+24 ];
+    void* p = NULL;
+    int fd = -1;
+    apilog_mmap_register();
+    if( keep < 1 )
+        keep = 1;
+    if( apilog_mm.seq >= keep ) {
+        sprintf( name, "%s.%lu", APILOG_MMAP_FILE, apilog_mm.seq-keep );
+        unlink( name );
+    }
+    sprintf( name, "%s.%lu", APILOG_MMAP_FILE, apilog_mm.seq );
+    fd = open( name, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if( fd < 0 )
+        return;
+#if defined( __linux__ )
+    if( posix_fallocate( fd, 0, (off_t)APILOG_SEGMENT_SIZE ) != 0 &&
+        ftruncate( fd, (off_t)APILOG_SEGMENT_SIZE ) != 0 ) {
+#else
+    if( ftruncate( fd, (off_t)APILOG_SEGMENT_SIZE ) != 0 ) {
+#endif
+        close( fd );
+        return;
+    }
+    p = mmap( NULL, APILOG_SEGMENT_SIZE, PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0 );
+    if( p == MAP_FAILED ) {
+        close( fd );
+        return;
+    }
+    apilog_mm.fd = fd;
+    apilog_mm.n = 0;
+    apilog_mm.used = APILOG_SEGMENT_SIZE;
+    __sync_synchronize();
+    apilog_mm.base = (char*)p;
+}
+
+
+APILOG_API void apilog_mmap_close( void ) {
+    APILOG_LOCK( apilog_mm.lock );
+    apilog_mmap_close_segment();
+    APILOG_UNLOCK( apilog_mm.lock );
+}
+
+
+/* Reserves `n` bytes in the current segment, starting a new segment
+ * if necessary. Returns NULL if there is no segment (or `n` is larger
+ * than a segment), otherwise the caller writes the bytes and calls
+ * `apilog_mmap_commit()`. */
+APILOG_API char* apilog_mmap_reserve( size_t n ) {
+    if( n > APILOG_SEGMENT_SIZE )
+        return NULL;
+    for( ;; ) {
+        unsigned long seq = 0;
+        char* base = NULL;
+        int failed = 0;
+        __sync_fetch_and_add( &apilog_mm.users, 1 );
+        seq = apilog_mm.seq;
+        base = apilog_mm.base;
+        if( base != NULL ) {
+            size_t off = __sync_fetch_and_add( &apilog_mm.n, n );
+            if( off + n <= APILOG_SEGMENT_SIZE )
+                return base + off;
+            if( off <= APILOG_SEGMENT_SIZE )
+                apilog_mm.used = off;
+        }
+        __sync_fetch_and_sub( &apilog_mm.users, 1 );
+        APILOG_LOCK( apilog_mm.lock );
+        if( apilog_mm.seq == seq ) { /* nobody switched segments yet */
+            apilog_mmap_close_segment();
+            apilog_mmap_open_segment();
+        }
+        failed = apilog_mm.base == NULL;
+        APILOG_UNLOCK( apilog_mm.lock );
+        if( failed )
+            return NULL;
+    }
+}
+
+
+APILOG_API void apilog_mmap_commit( void ) {
+    __sync_fetch_and_sub( &apilog_mm.users, 1 );
+}
+
+
+APILOG_API long apilog_mmap_write( char const* p, size_t n ) {
+    char* d = apilog_mmap_reserve( n );
+    if( d == NULL )
+        return (long)write( 2, p, n );
+    memcpy( d, p, n );
+    apilog_mmap_commit();
+    return (long)n;
+}
+#endif /* APILOG_MMAP */
+
+
+APILOG_API void apilog_write( char const* p, size_t n ) {
+    while( n > 0 ) {
+        long w = (long)APILOG_WRITE( p, n );
+        if( w <= 0 )
+            break;
+        p += w;
+        n -= (size_t)w;
+    }
+}
+
+
+#if defined( APILOG_ASYNC )
+static int volatile apilog_async_state = 0; /* 1 running, 2 stopping */
+#if defined( _WIN32 )
+static HANDLE apilog_async_thread;
+#else
+static pthread_t apilog_async_thread;
+#endif
+
+#if defined( __i386__ ) || defined( __x86_64__ )
+#define APILOG_PAUSE() __builtin_ia32_pause()
+#elif defined( __aarch64__ )
+#define APILOG_PAUSE() __asm__ __volatile__( "yield" )
+#else
+#define APILOG_PAUSE() ((void)0)
+#endif
+
+
+/* Sleeps for about `us` microseconds (at least 1ms on Windows). */
+APILOG_API void apilog_async_sleep( long us ) {
+#if defined( _WIN32 )
+    Sleep( (DWORD)((us + 999) / 1000) );
+#else
+    struct timespec ts;
+    ts.tv_sec = 0;
+    ts.tv_nsec = us * 1000;
+    nanosleep( &ts, NULL );
+#endif
+}
+
+
+/* Returns the buffer after `b` in the buffer list, or the first one
+ * if `b` is NULL. Taking the lock orders the load after the
+ * publication of new buffers and after `apilog_async_retire()`. */
+APILOG_API apilog_tbuf* apilog_async_next( apilog_tbuf* b ) {
+    apilog_tbuf* next = NULL;
+    APILOG_LOCK( apilog_tbuflock );
+    next = b != NULL ? b->next : apilog_tbufs;
+    APILOG_UNLOCK( apilog_tbuflock );
+    return next;
+}
+
+
+/* Called by the background thread when the owner of `b` has exited
+ * and the ring buffer is empty: moves `b` to the free list. The
+ * memory is not released because other threads might still hold a
+ * pointer to the buffer (e.g. in `apilog_flush()`). */
+APILOG_API void apilog_async_retire( apilog_tbuf* b ) {
+    apilog_tbuf* volatile* link = &apilog_tbufs;
+    APILOG_LOCK( apilog_tbuflock );
+    while( *link != NULL && *link != b )
+        link = &(*link)->next;
+    if( *link == b ) {
+        *link = b->next;
+        apilog_freedropped += b->dropped;
+        b->nextfree = apilog_freetbufs;
+        apilog_freetbufs = b;
+    }
+    APILOG_UNLOCK( apilog_tbuflock );
+}
+
+
+/* Called by the background thread: writes everything that is in
+ * the ring buffer of `b`, returns the number of bytes written. */
+APILOG_API size_t apilog_async_drain( apilog_tbuf* b ) {
+    size_t head = b->head;
+    size_t tail = b->tail;
+    size_t n = head - tail;
+    unsigned long dropped = 0;
+    __sync_synchronize();
+    dropped = b->dropped;
+    if( n > 0 ) {
+        size_t off = tail & (APILOG_QUEUE_SIZE-1);
+        size_t k = APILOG_QUEUE_SIZE - off;
+        if( k > n )
+            k = n;
+        apilog_write( b->queue + off, k );
+        apilog_write( b->queue, n - k );
+        __sync_synchronize();
+        b->tail = head;
+    }
+    if( dropped != b->reported ) {
+        char line[ 64 ];
+        char* p = line + sizeof( line );
+        static char const msg[] = " records dropped\n";
+        p -= sizeof( msg )-1;
+        memcpy( p, msg, sizeof( msg )-1 );
+        p = apilog_fmtint( p, (long)(dropped - b->reported) );
+        p -= 8;
+        memcpy( p, "apilog: ", 8 );
+        apilog_write( p, (size_t)(line + sizeof( line ) - p) );
+        b->reported = dropped;
+    }
+    return n;
+}
+
+
+#if defined( _WIN32 )
+static DWORD WINAPI apilog_async_main( LPVOID arg ) {
+#else
+static void* apilog_async_main( void* arg ) {
+#endif
+    for( ;; ) {
+        int stopping = apilog_async_state == 2;
+        size_t n = 0;
+        apilog_tbuf* b = NULL;
+        apilog_tbuf* next = NULL;
+        for( b = apilog_async_next( NULL ); b != NULL; b = next ) {
+            next = apilog_async_next( b );
+            n += apilog_async_drain( b );
+            if( b->retired ) {
+                __sync_synchronize();
+                if( b->head == b->tail )
+                    apilog_async_retire( b );
+            }
+        }
+        if( n == 0 ) {
+            if( stopping )
+                break;
+            apilog_async_sleep( 1000 );
+        }
+    }
+    (void)arg;
+    return 0;
+}
+
+
+/* Copies a record into the ring buffer of the current thread. Never
+ * blocks (unless APILOG_ASYNC_BLOCK is defined) and never calls into
+ * the operating system. */
+APILOG_API void apilog_async_put( apilog_tbuf* b ) {
+    size_t head = b->head;
+    size_t off = head & (APILOG_QUEUE_SIZE-1);
+    size_t k = APILOG_QUEUE_SIZE - off;
+#if defined( APILOG_ASYNC_BLOCK )
+    unsigned spins = 0;
+#endif
+    while( APILOG_QUEUE_SIZE - (head - b->tail) < b->n ) {
+#if defined( APILOG_ASYNC_BLOCK )
+        if( apilog_async_state == 1 ) {
+            /* back off while the background thread makes room */
+            if( ++spins < 64 )
+                APILOG_PAUSE();
+            else
+                apilog_async_sleep( 100 );
+            continue;
+        }
+#endif
+        b->dropped++;
+        return;
+    }
+    if( k > b->n )
+        k = b->n;
+    memcpy( b->queue + off, b->data, k );
+    memcpy( b->queue, b->data + k, b->n - k );
+    __sync_synchronize();
+    b->head = head + b->n;
+}
+
+
+/* Returns the number of records that have been dropped so far. */
+APILOG_API unsigned long apilog_dropped( void ) {
+    unsigned long n = 0;
+    apilog_tbuf* b = NULL;
+    APILOG_LOCK( apilog_tbuflock );
+    n = apilog_freedropped;
+    for( b = apilog_tbufs; b != NULL; b = b->next )
+        n += b->dropped;
+    APILOG_UNLOCK( apilog_tbuflock );
+    return n;
+}
+#endif /* APILOG_ASYNC */
+
+
+/* Must be called with `b->lock` held. */
+APILOG_API void apilog_tbuf_flush( apilog_tbuf* b ) {
+#if defined( APILOG_ASYNC )
+    if( apilog_async_state == 1 )
+        apilog_async_put( b );
+    else
+#endif
+    apilog_write( b->data, b->n );
+    b->n = 0;
+    b->count = 0;
+}
+
+
+#if defined( APILOG_ASYNC )
+/* Waits until the background thread has written all queued records.
+ * At program exit the background thread is stopped. */
+APILOG_API void apilog_flush( void ) {
+    apilog_tbuf* b = NULL;
+    for( b = apilog_async_next( NULL ); b != NULL;
+         b = apilog_async_next( b ) ) {
+        size_t head = b->head;
+        while( apilog_async_state == 1 && (long)(head - b->tail) > 0 )
+            apilog_async_sleep( 1000 );
+    }
+}
+
+
+APILOG_API void apilog_async_stop( void ) {
+    if( apilog_async_state == 1 ) {
+        apilog_async_state = 2;
+#if defined( _WIN32 )
+        WaitForSingleObject( apilog_async_thread, INFINITE );
+#else
+        pthread_join( apilog_async_thread, NULL );
+#endif
+    }
+    apilog_async_state = 0;
+}
+#else
+/* Writes the buffered log lines of all threads to `stderr`. This
+ * also happens automatically at program exit. */
+APILOG_API void apilog_flush( void ) {
+    apilog_tbuf* b = NULL;
+    APILOG_LOCK( apilog_tbuflock );
+    for( b = apilog_tbufs; b != NULL; b = b->next ) {
+        APILOG_LOCK( b->lock );
+        apilog_tbuf_flush( b );
+        APILOG_UNLOCK( b->lock );
+    }
+    APILOG_UNLOCK( apilog_tbuflock );
+}
+#endif
+
+
+#if defined( APILOG_ASYNC )
+/* Must be called with `apilog_tbuflock` held. */
+APILOG_API apilog_tbuf* apilog_tbuf_alloc( void ) {
+    apilog_tbuf* b = apilog_freetbufs;
+    if( b != NULL ) {
+        apilog_freetbufs = b->nextfree;
+        apilog_freedropped -= b->dropped;
+    } else if( (b = (apilog_tbuf*)malloc( sizeof( *b ) )) == NULL )
+        return NULL;
+    b->head = 0;
+    b->tail = 0;
+    b->dropped = 0;
+    b->reported = 0;
+    b->retired = 0;
+    return b;
+}
+
+
+#if !defined( _WIN32 )
+/* Runs when a thread with a buffer exits. */
+APILOG_API void apilog_async_exit( void* p ) {
+    apilog_tbuf* b = (apilog_tbuf*)p;
+    if( b->n > 0 )
+        apilog_tbuf_flush( b );
+    apilog_mytbuf = NULL;
+    __sync_synchronize();
+    b->retired = 1;
+}
+#endif
+#else
+#define apilog_tbuf_alloc() ((apilog_tbuf*)malloc( sizeof( apilog_tbuf ) ))
+#endif
+
+
+APILOG_API apilog_tbuf* apilog_tbuf_get( void ) {
+    apilog_tbuf* b = apilog_mytbuf;
+    if( b == NULL ) {
+        APILOG_LOCK( apilog_tbuflock );
+        if( (b = apilog_tbuf_alloc()) == NULL ) {
+            APILOG_UNLOCK( apilog_tbuflock );
+            return NULL;
+        }
+        b->n = 0;
+        b->count = 0;
+        b->lock = 0;
+        if( !apilog_tbufinit ) {
+            apilog_tbufinit = 1;
+#if defined( APILOG_MMAP )
+            /* must run after the buffers have been flushed */
+            APILOG_LOCK( apilog_mm.lock );
+            apilog_mmap_register();
+            APILOG_UNLOCK( apilog_mm.lock );
+#endif
+#if defined( APILOG_ASYNC )
+#if defined( _WIN32 )
+            apilog_async_thread = CreateThread( NULL, 0, apilog_async_main,
+                                                NULL, 0, NULL );
+            if( apilog_async_thread != NULL )
+                apilog_async_state = 1;
+#else
+            if( pthread_key_create( &apilog_tbufkey,
+                                    apilog_async_exit ) == 0 &&
+                pthread_create( &apilog_async_thread, NULL,
+                                apilog_async_main, NULL ) == 0 )
+                apilog_async_state = 1;
+#endif
+            atexit( apilog_async_stop );
+#else
+            atexit( apilog_flush );
+#endif
+        }
+        b->next = apilog_tbufs;
+        APILOG_PUBLISH();
+        apilog_tbufs = b;
+        APILOG_UNLOCK( apilog_tbuflock );
+        apilog_mytbuf = b;
+#if defined( APILOG_ASYNC ) && !defined( _WIN32 )
+        if( apilog_async_state == 1 )
+            pthread_setspecific( apilog_tbufkey, b );
+#endif
+    }
+    return b;
+}
+
+
+/* Must be called with `b->lock` held. */
+APILOG_API void apilog_tbuf_put( apilog_tbuf* b, char const* s, size_t n ) {
+    while( n > APILOG_BUFFER_SIZE - b->n ) {
+        size_t k = APILOG_BUFFER_SIZE - b->n;
+        memcpy( b->data + b->n, s, k );
+        b->n += k;
+        s += k;
+        n -= k;
+        apilog_tbuf_flush( b );
+    }
+    memcpy( b->data + b->n, s, n );
+    b->n += n;
+}
+#endif /* APILOG_BUFFERED */
+
+
+#if defined( APILOG_DIFF )
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef APILOG_KEYFRAME
+#define APILOG_KEYFRAME 64
+#endif
+
+/* Known stack effects of the wrapped API functions, so that only the
+ * stack slots that may have changed need to be inspected. */
+#define APILOG_FX_TOP 0   /* only the top `n` slots may change */
+#define APILOG_FX_SLOT 1  /* the APILOG_HINT slot, top shrinks by `n` */
+#define APILOG_FX_RANGE 2 /* APILOG_HINT slot to top, top shrinks by `n` */
+#define APILOG_FX_FULL 3  /* any slot may change */
+#define APILOG_FX_KEY 4   /* may run arbitrary code, log a keyframe */
+
+static APILOG_TLS int apilog_hint = 0;
+/* Counts API calls that weren't logged (races only lose increments,
+ * which is fine, because any change forces a keyframe). */
+static unsigned long volatile apilog_skips = 0;
+#define APILOG_SKIP() ((void)(apilog_hint = 0, apilog_skips++))
+
+
+APILOG_API void apilog_set_hint( int index ) {
+    apilog_hint = index;
+}
+
+
+static struct {
+    char const* api;
+    unsigned char kind;
+    unsigned char n;
+} const apilog_effects[] = {
+    { "lua_arith", APILOG_FX_TOP, 1 },
+    { "lua_call", APILOG_FX_KEY, 0 },
+    { "lua_callk", APILOG_FX_KEY, 0 },
+    { "lua_concat", APILOG_FX_TOP, 1 },
+    { "lua_copy", APILOG_FX_SLOT, 0 },
+    { "lua_cpcall", APILOG_FX_KEY, 0 },
+    { "lua_createtable", APILOG_FX_TOP, 1 },
+    { "lua_getfenv", APILOG_FX_TOP, 1 },
+    { "lua_getfield", APILOG_FX_TOP, 1 },
+    { "lua_getglobal", APILOG_FX_TOP, 1 },
+    { "lua_geti", APILOG_FX_TOP, 1 },
+    { "lua_getinfo", APILOG_FX_TOP, 2 },
+    { "lua_getlocal", APILOG_FX_TOP, 1 },
+    { "lua_getmetatable", APILOG_FX_TOP, 1 },
+    { "lua_gettable", APILOG_FX_TOP, 1 },
+    { "lua_getupvalue", APILOG_FX_TOP, 1 },
+    { "lua_getuservalue", APILOG_FX_TOP, 1 },
+    { "lua_insert", APILOG_FX_RANGE, 0 },
+    { "lua_len", APILOG_FX_TOP, 1 },
+    { "lua_load", APILOG_FX_TOP, 1 },
+    { "lua_newtable", APILOG_FX_TOP, 1 },
+    { "lua_newthread", APILOG_FX_TOP, 1 },
+    { "lua_newuserdata", APILOG_FX_TOP, 1 },
+    { "lua_next", APILOG_FX_TOP, 2 },
+    { "lua_pcall", APILOG_FX_KEY, 0 },
+    { "lua_pcallk", APILOG_FX_KEY, 0 },
+    { "lua_pop", APILOG_FX_TOP, 0 },
+    { "lua_pushboolean", APILOG_FX_TOP, 1 },
+    { "lua_pushcclosure", APILOG_FX_TOP, 1 },
+    { "lua_pushcfunction", APILOG_FX_TOP, 1 },
+    { "lua_pushfstring", APILOG_FX_TOP, 1 },
+    { "lua_pushglobaltable", APILOG_FX_TOP, 1 },
+    { "lua_pushinteger", APILOG_FX_TOP, 1 },
+    { "lua_pushlightuserdata", APILOG_FX_TOP, 1 },
+    { "lua_pushliteral", APILOG_FX_TOP, 1 },
+    { "lua_pushlstring", APILOG_FX_TOP, 1 },
+    { "lua_pushnil", APILOG_FX_TOP, 1 },
+    { "lua_pushnumber", APILOG_FX_TOP, 1 },
+    { "lua_pushstring", APILOG_FX_TOP, 1 },
+    { "lua_pushthread", APILOG_FX_TOP, 1 },
+    { "lua_pushunsigned", APILOG_FX_TOP, 1 },
+    { "lua_pushvalue", APILOG_FX_TOP, 1 },
+    { "lua_pushvfstring", APILOG_FX_TOP, 1 },
+    { "lua_rawget", APILOG_FX_TOP, 1 },
+    { "lua_rawgeti", APILOG_FX_TOP, 1 },
+    { "lua_rawgetp", APILOG_FX_TOP, 1 },
+    { "lua_rawset", APILOG_FX_TOP, 0 },
+    { "lua_rawseti", APILOG_FX_TOP, 0 },
+    { "lua_rawsetp", APILOG_FX_TOP, 0 },
+    { "lua_remove", APILOG_FX_RANGE, 1 },
+    { "lua_replace", APILOG_FX_SLOT, 1 },
+    { "lua_resume", APILOG_FX_KEY, 0 },
+    { "lua_rotate", APILOG_FX_RANGE, 0 },
+    { "lua_setfenv", APILOG_FX_TOP, 0 },
+    { "lua_setfield", APILOG_FX_TOP, 0 },
+    { "lua_setglobal", APILOG_FX_TOP, 0 },
+    { "lua_seti", APILOG_FX_TOP, 0 },
+    { "lua_setlocal", APILOG_FX_TOP, 0 },
+    { "lua_setmetatable", APILOG_FX_TOP, 0 },
+    { "lua_settable", APILOG_FX_TOP, 0 },
+    { "lua_settop", APILOG_FX_TOP, 0 },
+    { "lua_setupvalue", APILOG_FX_TOP, 0 },
+    { "lua_setuservalue", APILOG_FX_TOP, 0 },
+    { "lua_stringtonumber", APILOG_FX_TOP, 1 },
+    { "lua_yield", APILOG_FX_TOP, 0 },
+    { "lua_yieldk", APILOG_FX_TOP, 0 },
+    { "luaL_callmeta", APILOG_FX_KEY, 0 },
+    { "luaL_checkany", APILOG_FX_TOP, 0 },
+    { "luaL_checkinteger", APILOG_FX_TOP, 0 },
+    { "luaL_checklstring", APILOG_FX_TOP, 0 },
+    { "luaL_checknumber", APILOG_FX_TOP, 0 },
+    { "luaL_checkoption", APILOG_FX_TOP, 0 },
+    { "luaL_checkstack", APILOG_FX_TOP, 0 },
+    { "luaL_checktype", APILOG_FX_TOP, 0 },
+    { "luaL_checkudata", APILOG_FX_TOP, 0 },
+    { "luaL_dofile", APILOG_FX_KEY, 0 },
+    { "luaL_dostring", APILOG_FX_KEY, 0 },
+    { "luaL_execresult", APILOG_FX_TOP, 3 },
+    { "luaL_fileresult", APILOG_FX_TOP, 3 },
+    { "luaL_getmetafield", APILOG_FX_TOP, 1 },
+    { "luaL_getmetatable", APILOG_FX_TOP, 1 },
+    { "luaL_getsubtable", APILOG_FX_TOP, 1 },
+    { "luaL_gsub", APILOG_FX_TOP, 1 },
+    { "luaL_loadbuffer", APILOG_FX_TOP, 1 },
+    { "luaL_loadbufferx", APILOG_FX_TOP, 1 },
+    { "luaL_loadfile", APILOG_FX_TOP, 1 },
+    { "luaL_loadfilex", APILOG_FX_TOP, 1 },
+    { "luaL_loadstring", APILOG_FX_TOP, 1 },
+    { "luaL_newlib", APILOG_FX_TOP, 1 },
+    { "luaL_newlibtable", APILOG_FX_TOP, 1 },
+    { "luaL_newmetatable", APILOG_FX_TOP, 1 },
+    { "luaL_optinteger", APILOG_FX_TOP, 0 },
+    { "luaL_optlstring", APILOG_FX_TOP, 0 },
+    { "luaL_optnumber", APILOG_FX_TOP, 0 },
+    { "luaL_ref", APILOG_FX_TOP, 0 },
+    { "luaL_register", APILOG_FX_TOP, 1 },
+    { "luaL_requiref", APILOG_FX_KEY, 0 },
+    { "luaL_setfuncs", APILOG_FX_TOP, 0 },
+    { "luaL_testudata", APILOG_FX_TOP, 0 },
+    { "luaL_tolstring", APILOG_FX_TOP, 1 },
+    { "luaL_traceback", APILOG_FX_TOP, 1 },
+    { "luaL_unref", APILOG_FX_TOP, 0 },
+    { "luaL_where", APILOG_FX_TOP, 1 }
+};
+
+
+APILOG_API int apilog_effect( char const* api ) {
+    size_t i = 0;
+    for( i = 0; i < sizeof( apilog_effects )/sizeof( *apilog_effects ); ++i )
+        if( strcmp( api, apilog_effects[ i ].api ) == 0 )
+            return (apilog_effects[ i ].kind << 8) | apilog_effects[ i ].n;
+    return APILOG_FX_FULL << 8;
+}
+
+
+/* Absolute index of a stack index passed to an API function that
+ * left the stack `shrink` slots smaller than it was before. */
+APILOG_API int apilog_absidx( int i, int top, int shrink ) {
+    if( i > 0 )
+        return i;
+    else if( i < 0 && i > LUA_REGISTRYINDEX )
+        return top + shrink + i + 1;
+    return 0;
+}
+
+
+typedef struct {
+    char* data;
+    size_t n;
+    size_t cap;
+} apilog_line;
+
+static APILOG_TLS apilog_line apilog_myline = { NULL, 0, 0 };
+
+
+APILOG_API void apilog_line_put( apilog_line* l, char const* s, size_t n ) {
+    if( n > l->cap - l->n ) {
+        size_t cap = l->cap > 0 ? 2*l->cap : 256;
+        char* data = NULL;
+        while( cap - l->n < n )
+            cap *= 2;
+        if( (data = (char*)realloc( l->data, cap )) == NULL )
+            return;
+        l->data = data;
+        l->cap = cap;
+    }
+    memcpy( l->data + l->n, s, n );
+    l->n += n;
+}
+
+
+APILOG_API void apilog_line_int( apilog_line* l, long i ) {
+    char num[ 24 ];
+    char* p = apilog_fmtint( num + sizeof( num ), i );
+    apilog_line_put( l, p, (size_t)(num + sizeof( num ) - p) );
+}
+
+
+/* In diff mode only the first log line for a `lua_State`, the first
+ * line after switching to another C function, and every
+ * APILOG_KEYFRAME-th line contain the full stack. All other lines
+ * look like `[ #5 2=i 5=t ]`, meaning that the stack has 5 slots,
+ * slot 2 now contains an integer, slot 5 a table, and all other
+ * slots are unchanged. Skipped API calls only bump `apilog_skips`,
+ * and the next logged line on any state after that is a keyframe. */
+APILOG_API void apilog_emit( lua_State* L,
+                             apilog_site* site,
+                             unsigned long weight ) {
+    int hint = apilog_hint;
+    apilog_hint = 0;
+    if( weight == 0 )
+        apilog_skips++;
+    else {
+        apilog_state* st = apilog_state_get( L );
+        apilog_line* l = &apilog_myline;
+        int top = lua_gettop( L );
+        int kind = APILOG_FX_FULL;
+        int n = 0;
+        int lo = 1;
+        int single = 0;
+        int run = 0;
+        int i = 0;
+        char slot[ 2 ] = { ' ', '?' };
+        if( st == NULL || apilog_state_reserve( st, top ) != 0 )
+            return;
+        if( !(site->flags & APILOG_SITE_EFFECT) ) {
+            site->fx = apilog_effect( site->api );
+            site->flags |= APILOG_SITE_EFFECT;
+        }
+        kind = site->fx >> 8;
+        n = site->fx & 0xFF;
+        l->n = 0;
+        apilog_line_put( l, site->api, strlen( site->api ) );
+        apilog_line_put( l, " in ", 4 );
+        apilog_line_put( l, site->func, strlen( site->func ) );
+        apilog_line_put( l, "@", 1 );
+        apilog_line_put( l, site->filename, strlen( site->filename ) );
+        apilog_line_put( l, ":", 1 );
+        apilog_line_int( l, site->lineno );
+        apilog_line_put( l, ":  [", 4 );
+        if( kind == APILOG_FX_KEY || st->func != site->func ||
+            st->count >= APILOG_KEYFRAME || st->skips != apilog_skips ) {
+            apilog_snapshot( L, 1, top, st->types+1 );
+            for( i = 1; i <= top; ++i ) {
+                slot[ 1 ] = APILOG_TYPECHARS[ st->types[ i ] ];
+                apilog_line_put( l, slot, 2 );
+            }
+            st->count = 0;
+        } else {
+            switch( kind ) {
+                case APILOG_FX_TOP:
+                    lo = top - n + 1;
+                    break;
+                case APILOG_FX_SLOT:
+                    single = apilog_absidx( hint, top, n );
+                    lo = hint != 0 ? top + 1 : 1;
+                    break;
+                case APILOG_FX_RANGE:
+                    lo = hint != 0 ? apilog_absidx( hint, top, n ) : 1;
+                    break;
+            }
+            if( lo > st->top + 1 )
+                lo = st->top + 1;
+            if( lo < 1 )
+                lo = 1;
+            apilog_line_put( l, " #", 2 );
+            apilog_line_int( l, top );
+            if( single > 0 && single < lo && single <= top ) {
+                int code = apilog_typecode( L, single );
+                if( code != st->types[ single ] ) {
+                    st->types[ single ] = (unsigned char)code;
+                    apilog_line_put( l, " ", 1 );
+                    apilog_line_int( l, single );
+                    apilog_line_put( l, "=", 1 );
+                    apilog_line_put( l, APILOG_TYPECHARS + code, 1 );
+                }
+            }
+            for( i = lo; i <= top; ++i ) {
+                int code = apilog_typecode( L, i );
+                if( i > st->top || code != st->types[ i ] ) {
+                    st->types[ i ] = (unsigned char)code;
+                    if( !run ) {
+                        apilog_line_put( l, " ", 1 );
+                        apilog_line_int( l, i );
+                        apilog_line_put( l, "=", 1 );
+                        run = 1;
+                    }
+                    apilog_line_put( l, APILOG_TYPECHARS + code, 1 );
+                } else
+                    run = 0;
+            }
+            st->count++;
+        }
+        apilog_line_put( l, " ]", 2 );
+        if( weight > 1 ) {
+            apilog_line_put( l, " (", 2 );
+            apilog_line_int( l, (long)(weight-1) );
+            apilog_line_put( l, " skipped)", 9 );
+        }
+        apilog_line_put( l, "\n", 1 );
+        st->top = top;
+        st->func = site->func;
+        st->skips = apilog_skips;
+#if defined( APILOG_BUFFERED )
+        {
+            apilog_tbuf* b = apilog_tbuf_get();
+            if( b != NULL ) {
+                APILOG_TBUF_LOCK( b );
+                apilog_tbuf_put( b, l->data, l->n );
+                if( ++b->count >= APILOG_BATCH )
+                    apilog_tbuf_flush( b );
+                APILOG_TBUF_UNLOCK( b );
+            }
+        }
+#else
+        fwrite( l->data, 1, l->n, stderr );
+#endif
+    }
+}
+
+#elif defined( APILOG_BUFFERED )
+
+#if defined( APILOG_MMAP ) && !defined( APILOG_ASYNC )
+APILOG_API char* apilog_mmap_put( char* d, char const* s, size_t n ) {
+    memcpy( d, s, n );
+    return d + n;
+}
+
+
+/* Formats a log line directly into the memory mapped segment. Returns
+ * 0 if there is no space for it. */
+APILOG_API int apilog_mmap_emit( lua_State* L,
+                                 apilog_site* site,
+                                 unsigned long weight,
+                                 int top ) {
+    size_t api = strlen( site->api );
+    size_t func = strlen( site->func );
+    size_t file = strlen( site->filename );
+    char num[ 24 ];
+    char skipped[ 24 ];
+    char* p = NULL;
+    char* s = skipped + sizeof( skipped );
+    char* d = NULL;
+    int i = 0;
+    num[ sizeof( num )-1 ] = ':';
+    p = apilog_fmtint( num + sizeof( num )-1, site->lineno );
+    *--p = ':';
+    if( weight > 1 )
+        s = apilog_fmtint( skipped + sizeof( skipped ), (long)(weight-1) );
+    d = apilog_mmap_reserve( api + 4 + func + 1 + file +
+                             (size_t)(num + sizeof( num ) - p) + 3 +
+                             2*(size_t)top + 2 + (weight > 1 ? 11 +
+                             (size_t)(skipped + sizeof( skipped ) - s) : 0) +
+                             1 );
+    if( d == NULL )
+        return 0;
+    d = apilog_mmap_put( d, site->api, api );
+    d = apilog_mmap_put( d, " in ", 4 );
+    d = apilog_mmap_put( d, site->func, func );
+    d = apilog_mmap_put( d, "@", 1 );
+    d = apilog_mmap_put( d, site->filename, file );
+    d = apilog_mmap_put( d, p, (size_t)(num + sizeof( num ) - p) );
+    d = apilog_mmap_put( d, "  [", 3 );
+    for( i = 1; i <= top; i += APILOG_CHUNK ) {
+        unsigned char codes[ APILOG_CHUNK ];
+        int m = top-i+1 < APILOG_CHUNK ? top-i+1 : APILOG_CHUNK;
+        int j = 0;
+        apilog_snapshot( L, i, m, codes );
+        for( j = 0; j < m; ++j ) {
+            *d++ = ' ';
+            *d++ = APILOG_TYPECHARS[ codes[ j ] ];
+        }
+    }
+    d = apilog_mmap_put( d, " ]", 2 );
+    if( weight > 1 ) {
+        d = apilog_mmap_put( d, " (", 2 );
+        d = apilog_mmap_put( d, s, (size_t)(skipped + sizeof( skipped ) - s) );
+        d = apilog_mmap_put( d, " skipped)", 9 );
+    }
+    *d = '\n';
+    apilog_mmap_commit();
+    return 1;
+}
+#endif
+
+
+APILOG_API void apilog_emit( lua_State* L,
+                             apilog_site* site,
+                             unsigned long weight ) {
+    if( weight > 0 ) {
+        apilog_tbuf* b = NULL;
+        int top = lua_gettop( L );
+        int i = 0;
+        char num[ 24 ];
+        char* p = NULL;
+#if defined( APILOG_MMAP ) && !defined( APILOG_ASYNC )
+        if( apilog_mmap_emit( L, site, weight, top ) )
+            return;
+#endif
+        if( (b = apilog_tbuf_get()) == NULL )
+            return;
+        num[ sizeof( num )-1 ] = ':';
+        p = apilog_fmtint( num + sizeof( num )-1, site->lineno );
+        *--p = ':';
+        APILOG_TBUF_LOCK( b );
+        apilog_tbuf_put( b, site->api, strlen( site->api ) );
+        apilog_tbuf_put( b, " in ", 4 );
+        apilog_tbuf_put( b, site->func, strlen( site->func ) );
+        apilog_tbuf_put( b, "@", 1 );
+        apilog_tbuf_put( b, site->filename, strlen( site->filename ) );
+        apilog_tbuf_put( b, p, (size_t)(num + sizeof( num ) - p) );
+        apilog_tbuf_put( b, "  [", 3 );
+        for( i = 1; i <= top; i += APILOG_CHUNK ) {
+            unsigned char codes[ APILOG_CHUNK ];
+            int m = top-i+1 < APILOG_CHUNK ? top-i+1 : APILOG_CHUNK;
+            int j = 0;
+            apilog_snapshot( L, i, m, codes );
+            if( APILOG_BUFFER_SIZE - b->n < 2*APILOG_CHUNK )
+                apilog_tbuf_flush( b );
+            for( j = 0; j < m; ++j ) {
+                b->data[ b->n++ ] = ' ';
+                b->data[ b->n++ ] = APILOG_TYPECHARS[ codes[ j ] ];
+            }
+        }
+        apilog_tbuf_put( b, " ]", 2 );
+        if( weight > 1 ) {
+            p = apilog_fmtint( num + sizeof( num ), (long)(weight-1) );
+            apilog_tbuf_put( b, " (", 2 );
+            apilog_tbuf_put( b, p, (size_t)(num + sizeof( num ) - p) );
+            apilog_tbuf_put( b, " skipped)", 9 );
+        }
+        apilog_tbuf_put( b, "\n", 1 );
+        if( ++b->count >= APILOG_BATCH )
+            apilog_tbuf_flush( b );
+        APILOG_TBUF_UNLOCK( b );
+    }
+}
+
+#else /* unbuffered text output to stderr */
+
+APILOG_API void apilog_emit( lua_State* L,
+                             apilog_site* site,
+                             unsigned long weight ) {
+    if( weight > 0 ) {
+        int top = lua_gettop( L );
+        int i = 0;
+        fprintf( stderr, "%s in %s@%s:%d:  [", site->api, site->func,
+                 site->filename, site->lineno );
+        for( i = 1; i <= top; i += APILOG_CHUNK ) {
+            unsigned char codes[ APILOG_CHUNK ];
+            char line[ 2*APILOG_CHUNK+1 ];
+            int m = top-i+1 < APILOG_CHUNK ? top-i+1 : APILOG_CHUNK;
+            int j = 0;
+            apilog_snapshot( L, i, m, codes );
+            for( j = 0; j < m; ++j ) {
+                line[ 2*j ] = ' ';
+                line[ 2*j+1 ] = APILOG_TYPECHARS[ codes[ j ] ];
+            }
+            line[ 2*m ] = '\0';
+            fputs( line, stderr );
+        }
+        if( weight > 1 )
+            fprintf( stderr, " ] (%lu skipped)\n", weight-1 );
+        else
+            fputs( " ]\n", stderr );
+    }
+}
+
+#endif /* APILOG_DIFF / APILOG_BUFFERED */
+#endif /* APILOG_BINARY */
+#endif /* APILOG_PRINT */
+
+
+#if defined( APILOG_PROFILE )
+#include <stdio.h>
+#include <stdlib.h>
+
+static int apilog_profiling = 0;
+
+
+APILOG_API int apilog_profile_keep( apilog_site const* s ) {
+    return s->calls > 0;
+}
+
+
+APILOG_API int apilog_profile_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->total < sb->total ? 1 : (sa->total > sb->total ? -1 : 0);
+}
+
+
+APILOG_API void apilog_profile_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%12s %14s %12s %12s  call site (times in " APILOG_TICKS ")\n",
+                 "calls", "total", "average", "max" );
+    else
+        fprintf( out, "%12llu %14llu %12llu %12llu  %s in %s@%s:%d\n",
+                 s->calls, s->total, s->total / s->calls, s->max,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes the number of calls and the total, average, and maximum
+ * time spent in the API function for every call site, most expensive
+ * call sites first. */
+APILOG_API void apilog_profile_report( FILE* out ) {
+    apilog_site_report( out, apilog_profile_keep, apilog_profile_cmp,
+                        apilog_profile_row );
+}
+
+
+APILOG_API void apilog_profile_atexit( void ) {
+    apilog_profile_report( stderr );
+}
+
+
+APILOG_API void apilog_profile_add( apilog_site* site, apilog_ticks t ) {
+    apilog_atexit_once( &apilog_profiling, apilog_profile_atexit );
+    APILOG_ADD( site->calls, 1 );
+    APILOG_ADD( site->total, t );
+    apilog_max( &site->max, t );
+}
+#endif /* APILOG_PROFILE */
+
+
+#if defined( APILOG_HISTOGRAM )
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int apilog_histograms = 0;
+
+
+APILOG_API int apilog_histogram_keep( apilog_site const* s ) {
+    return s->hist.n > 0;
+}
+
+
+APILOG_API int apilog_histogram_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    int c = strcmp( sa->api, sb->api );
+    if( c == 0 )
+        c = sa->id < sb->id ? -1 : (sa->id > sb->id ? 1 : 0);
+    return c;
+}
+
+
+APILOG_API void apilog_histogram_row( FILE* out, apilog_hist const* h ) {
+    fprintf( out, "%12lu %10llu %10llu %10llu %10llu %10llu",
+             h->n, apilog_hist_percentile( h, 500 ),
+             apilog_hist_percentile( h, 900 ),
+             apilog_hist_percentile( h, 990 ),
+             apilog_hist_percentile( h, 999 ), h->max );
+}
+
+
+/* Writes latency percentiles for every wrapped API function (the
+ * histograms of all its call sites merged) followed by the
+ * percentiles of every single call site. */
+APILOG_API void apilog_histogram_report( FILE* out ) {
+    apilog_site** sites = NULL;
+    apilog_hist* sum = NULL;
+    size_t n = 0;
+    size_t i = 0;
+    size_t j = 0;
+    sites = apilog_site_list( apilog_histogram_keep, apilog_histogram_cmp,
+                              NULL, &n );
+    sum = (apilog_hist*)malloc( sizeof( *sum ) );
+    if( sites == NULL || sum == NULL ) {
+        free( sites );
+        free( sum );
+        return;
+    }
+    fprintf( out, "%12s %10s %10s %10s %10s %10s  API function "
+             "(times in " APILOG_TICKS ")\n",
+             "calls", "p50", "p90", "p99", "p99.9", "max" );
+    for( i = 0; i < n; i = j ) {
+        memset( sum, 0, sizeof( *sum ) );
+        for( j = i; j < n && !strcmp( sites[ i ]->api, sites[ j ]->api ); ++j )
+            apilog_hist_merge( sum, &sites[ j ]->hist );
+        apilog_histogram_row( out, sum );
+        fprintf( out, "  %s\n", sites[ i ]->api );
+    }
+    fprintf( out, "%12s %10s %10s %10s %10s %10s  call site\n",
+             "calls", "p50", "p90", "p99", "p99.9", "max" );
+    for( i = 0; i < n; ++i ) {
+        apilog_site const* s = sites[ i ];
+        apilog_histogram_row( out, &s->hist );
+        fprintf( out, "  %s in %s@%s:%d\n", s->api, s->func,
+                 s->filename, s->lineno );
+    }
+    free( sum );
+    free( sites );
+}
+
+
+APILOG_API void apilog_histogram_atexit( void ) {
+    apilog_histogram_report( stderr );
+}
+
+
+APILOG_API void apilog_histogram_add( apilog_site* site, apilog_ticks t ) {
+    apilog_atexit_once( &apilog_histograms, apilog_histogram_atexit );
+    apilog_hist_add( &site->hist, t );
+}
+#endif /* APILOG_HISTOGRAM */
+
+
+#if defined( APILOG_SUMMARY )
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef APILOG_FUNC_BUCKETS
+#define APILOG_FUNC_BUCKETS 256
+#endif
+
+/* Per C function (i.e. per `apilog_func`) summary. A run is a
+ * sequence of consecutive logged API calls of that function on the
+ * same `lua_State`; it ends when another function logs on that
+ * `lua_State`. The stack delta of a run is the stack top after its
+ * last API call minus the stack top before its first one. */
+typedef struct apilog_fsum {
+    struct apilog_fsum* next;
+    char const* func;
+    char const* filename;
+    unsigned long runs;
+    unsigned long calls;
+    long delta;
+    int mindelta;
+    int maxdelta;
+    int peak;
+} apilog_fsum;
+
+static apilog_fsum* apilog_fsumtab[ APILOG_FUNC_BUCKETS ];
+static size_t apilog_nfsums = 0;
+static int volatile apilog_fsumlock = 0;
+static int apilog_summarizing = 0;
+
+
+/* Must be called with `apilog_fsumlock` held. */
+APILOG_API apilog_fsum* apilog_fsum_get( char const* func,
+                                         char const* filename ) {
+    size_t h = ((size_t)func >> 3) % APILOG_FUNC_BUCKETS;
+    apilog_fsum* f = NULL;
+    for( f = apilog_fsumtab[ h ]; f != NULL; f = f->next )
+        if( f->func == func )
+            return f;
+    if( (f = (apilog_fsum*)calloc( 1, sizeof( *f ) )) != NULL ) {
+        f->func = func;
+        f->filename = filename;
+        f->next = apilog_fsumtab[ h ];
+        apilog_fsumtab[ h ] = f;
+        apilog_nfsums++;
+    }
+    return f;
+}
+
+
+APILOG_API void apilog_summary_end( apilog_state* s ) {
+    if( s->rfunc != NULL ) {
+        int d = s->rtop - s->rbase;
+        apilog_fsum* f = NULL;
+        APILOG_LOCK( apilog_fsumlock );
+        f = apilog_fsum_get( s->rfunc, s->rfile );
+        if( f != NULL ) {
+            if( f->runs == 0 || d < f->mindelta )
+                f->mindelta = d;
+            if( f->runs == 0 || d > f->maxdelta )
+                f->maxdelta = d;
+            if( s->rpeak > f->peak )
+                f->peak = s->rpeak;
+            f->runs++;
+            f->calls += s->rcalls;
+            f->delta += d;
+        }
+        APILOG_UNLOCK( apilog_fsumlock );
+        s->rfunc = NULL;
+    }
+}
+
+
+APILOG_API int apilog_summary_cmp( void const* a, void const* b ) {
+    apilog_fsum const* fa = *(apilog_fsum const* const*)a;
+    apilog_fsum const* fb = *(apilog_fsum const* const*)b;
+    return fa->calls < fb->calls ? 1 : (fa->calls > fb->calls ? -1 : 0);
+}
+
+
+/* Ends all current runs and writes the number of runs and API calls,
+ * the net stack delta per run, and the peak stack depth for every C
+ * function, functions with the most API calls first. */
+APILOG_API void apilog_summary_report( FILE* out ) {
+    apilog_fsum** fs = NULL;
+    size_t n = 0;
+    size_t i = 0;
+    for( i = 0; i < APILOG_STATE_BUCKETS; ++i ) {
+        apilog_state* s = apilog_statetab[ i ];
+        for( ; s != NULL; s = s->next )
+            apilog_summary_end( s );
+    }
+    APILOG_LOCK( apilog_fsumlock );
+    fs = (apilog_fsum**)malloc( (apilog_nfsums+1) * sizeof( *fs ) );
+    if( fs != NULL ) {
+        for( i = 0; i < APILOG_FUNC_BUCKETS; ++i ) {
+            apilog_fsum* f = apilog_fsumtab[ i ];
+            for( ; f != NULL; f = f->next )
+                fs[ n++ ] = f;
+        }
+    }
+    APILOG_UNLOCK( apilog_fsumlock );
+    if( fs == NULL )
+        return;
+    qsort( fs, n, sizeof( *fs ), apilog_summary_cmp );
+    fprintf( out, "%10s %12s %9s %6s %6s %6s  function\n",
+             "runs", "calls", "avg delta", "min", "max", "peak" );
+    for( i = 0; i < n; ++i ) {
+        apilog_fsum const* f = fs[ i ];
+        fprintf( out, "%10lu %12lu %9.2f %6d %6d %6d  %s@%s\n",
+                 f->runs, f->calls, (double)f->delta / (double)f->runs,
+                 f->mindelta, f->maxdelta, f->peak, f->func, f->filename );
+    }
+    free( fs );
+}
+
+
+APILOG_API void apilog_summary_atexit( void ) {
+    apilog_summary_report( stderr );
+}
+
+
+/* `base` is the stack top before the API call. */
+APILOG_API void apilog_summary_add( lua_State* L,
+                                    apilog_site* site,
+                                    int base ) {
+    apilog_state* s = apilog_state_get( L );
+    int top = lua_gettop( L );
+    apilog_atexit_once( &apilog_summarizing, apilog_summary_atexit );
+    if( s == NULL )
+        return;
+    if( s->rfunc != site->func ) {
+        apilog_summary_end( s );
+        s->rfunc = site->func;
+        s->rfile = site->filename;
+        s->rcalls = 0;
+        s->rbase = base;
+        s->rpeak = base;
+    }
+    s->rcalls++;
+    s->rtop = top;
+    if( top > s->rpeak )
+        s->rpeak = top;
+}
+#endif /* APILOG_SUMMARY */
+
+
+#if defined( APILOG_CALLTREE ) || defined( APILOG_ALLOC )
+/* The call tree and the allocation profiler identify a running
+ * wrapper by the address of its `apilog_frame` on the C stack. Code
+ * that runs within a wrapped API call is deeper on the C stack, so a
+ * recorded wrapper that isn't above the current one must have been
+ * skipped by a `longjmp()` out of a failed (or yielding) call. */
+#if defined( APILOG_STACK_GROWS_UP )
+#define APILOG_DEEPER( a, b ) ((size_t)(a) > (size_t)(b))
+#else
+#define APILOG_DEEPER( a, b ) ((size_t)(a) < (size_t)(b))
+#endif
+#endif
+
+
+#if defined( APILOG_CALLTREE )
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef APILOG_FOLDED_FILE
+#define APILOG_FOLDED_FILE "apilog.folded"
+#endif
+
+static apilog_node* apilog_roots = NULL;
+static size_t apilog_nnodes = 0;
+static int volatile apilog_nodelock = 0;
+static int apilog_tracing = 0;
+
+
+APILOG_API apilog_node* apilog_node_get( apilog_node* parent,
+                                         apilog_site* site ) {
+    apilog_node* volatile* head = parent ? &parent->children : &apilog_roots;
+    apilog_node* n = NULL;
+    for( n = *head; n != NULL; n = n->next )
+        if( n->site == site )
+            return n;
+    APILOG_LOCK( apilog_nodelock );
+    for( n = *head; n != NULL; n = n->next )
+        if( n->site == site )
+            break;
+    if( n == NULL && (n = (apilog_node*)calloc( 1, sizeof( *n ) )) != NULL ) {
+        n->site = site;
+        n->parent = parent;
+        n->next = *head;
+        APILOG_PUBLISH();
+        *head = n;
+        apilog_nnodes++;
+    }
+    APILOG_UNLOCK( apilog_nodelock );
+    return n;
+}
+
+
+typedef struct {
+    char* data;
+    size_t n;
+    size_t cap;
+} apilog_path;
+
+
+APILOG_API int apilog_path_put( apilog_path* p, char const* s ) {
+    size_t n = strlen( s );
+    if( p->n + n + 2 > p->cap ) {
+        size_t cap = p->cap > 0 ? 2*p->cap : 256;
+        char* data = NULL;
+        while( cap < p->n + n + 2 )
+            cap *= 2;
+        if( (data = (char*)realloc( p->data, cap )) == NULL )
+            return -1;
+        p->data = data;
+        p->cap = cap;
+    }
+    if( p->n > 0 )
+        p->data[ p->n++ ] = ';';
+    memcpy( p->data + p->n, s, n );
+    p->n += n;
+    p->data[ p->n ] = '\0';
+    return 0;
+}
+
+
+/* Writes one line per path in the call tree with the exclusive time
+ * spent in the last API call of the path. */
+APILOG_API void apilog_fold( FILE* out, apilog_node const* n,
+                             apilog_path* p ) {
+    for( ; n != NULL; n = n->next ) {
+        size_t len = p->n;
+        if( apilog_path_put( p, n->site->func ) == 0 &&
+            apilog_path_put( p, n->site->api ) == 0 ) {
+            if( n->excl > 0 )
+                fprintf( out, "%s %llu\n", p->data, n->excl );
+            apilog_fold( out, n->children, p );
+        }
+        p->n = len;
+        if( p->data != NULL )
+            p->data[ len ] = '\0';
+    }
+}
+
+
+APILOG_API int apilog_calltree_keep( apilog_site const* s ) {
+    return s->tcalls > 0;
+}
+
+
+APILOG_API int apilog_calltree_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->excl < sb->excl ? 1 : (sa->excl > sb->excl ? -1 : 0);
+}
+
+
+APILOG_API void apilog_calltree_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%12s %14s %14s  call site (times in " APILOG_TICKS ")\n",
+                 "calls", "inclusive", "exclusive" );
+    else
+        fprintf( out, "%12llu %14llu %14llu  %s in %s@%s:%d\n",
+                 s->tcalls, s->incl, s->excl,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes the inclusive and exclusive time of every call site, most
+ * exclusive time first, and the call tree in folded stack format
+ * (`func;api;func;api... time`) to `folded` (if not NULL). */
+APILOG_API void apilog_calltree_report( FILE* out, FILE* folded ) {
+    if( folded != NULL ) {
+        apilog_path p = { NULL, 0, 0 };
+        apilog_fold( folded, apilog_roots, &p );
+        free( p.data );
+    }
+    if( out != NULL )
+        apilog_site_report( out, apilog_calltree_keep, apilog_calltree_cmp,
+                            apilog_calltree_row );
+}
+
+
+APILOG_API void apilog_calltree_atexit( void ) {
+    FILE* f = fopen( APILOG_FOLDED_FILE, "w" );
+    apilog_calltree_report( stderr, f );
+    if( f != NULL )
+        fclose( f );
+}
+
+
+/* Pushes a new frame on the shadow call stack of `L`, returns its
+ * depth or -1. Frames whose wrapper has been skipped by an error or a
+ * yield are dropped first. No C function is active in a suspended (or
+ * dead) coroutine. */
+APILOG_API int apilog_calltree_push( lua_State* L, apilog_site* site,
+                                     void const* sp ) {
+    apilog_state* s = apilog_state_get( L );
+    apilog_node* n = NULL;
+    apilog_atexit_once( &apilog_tracing, apilog_calltree_atexit );
+    if( s == NULL )
+        return -1;
+    if( lua_status( L ) != 0 )
+        s->depth = 0;
+    while( s->depth > 0 && !APILOG_DEEPER( sp, s->frames[ s->depth-1 ].sp ) )
+        s->depth--;
+    if( s->depth >= s->fcap ) {
+        int cap = s->fcap > 0 ? 2*s->fcap : 16;
+        apilog_sframe* f = (apilog_sframe*)realloc( s->frames,
+                                                    cap * sizeof( *f ) );
+        if( f == NULL )
+            return -1;
+        s->frames = f;
+        s->fcap = cap;
+    }
+    n = apilog_node_get( s->depth > 0 ? s->frames[ s->depth-1 ].node : NULL,
+                         site );
+    if( n == NULL )
+        return -1;
+    s->frames[ s->depth ].node = n;
+    s->frames[ s->depth ].child = 0;
+    s->frames[ s->depth ].sp = sp;
+    return s->depth++;
+}
+
+
+/* Pops the frame at `depth` (and any stale frames above it that
+ * were skipped by a `longjmp()` out of a failed or yielding call). */
+APILOG_API void apilog_calltree_pop( lua_State* L, int depth,
+                                     void const* sp, apilog_ticks t ) {
+    apilog_state* s = apilog_state_get( L );
+    apilog_sframe* f = NULL;
+    apilog_ticks excl = 0;
+    if( s == NULL || depth < 0 || depth >= s->depth ||
+        s->frames[ depth ].sp != sp )
+        return;
+    f = s->frames + depth;
+    excl = t > f->child ? t - f->child : 0;
+    APILOG_ADD( f->node->calls, 1 );
+    APILOG_ADD( f->node->incl, t );
+    APILOG_ADD( f->node->excl, excl );
+    APILOG_ADD( f->node->site->tcalls, 1 );
+    APILOG_ADD( f->node->site->incl, t );
+    APILOG_ADD( f->node->site->excl, excl );
+    s->depth = depth;
+    if( depth > 0 )
+        s->frames[ depth-1 ].child += t;
+}
+#endif /* APILOG_CALLTREE */
+
+
+#if defined( APILOG_CHROME )
+#include <stdio.h>
+#include <string.h>
+#if defined( _WIN32 )
+#include <process.h>
+#define APILOG_GETPID() _getpid()
+#else
+#include <unistd.h>
+#define APILOG_GETPID() getpid()
+#endif
+
+#ifndef APILOG_CHROME_FILE
+#define APILOG_CHROME_FILE "apilog.json"
+#endif
+
+/* Every logged API call becomes a complete ("X") event in the Chrome
+ * trace event format. Events go to a shared buffer that is written
+ * to the trace file whenever it is full, so the file can grow
+ * without bounds. The `lua_State` is used as the thread id (i.e. the
+ * track), the real thread is in the event arguments. */
+static struct {
+    FILE* f;
+    size_t n;
+    int registered;
+    int volatile lock;
+    char data[ 65536 ];
+} apilog_chrome = { NULL, 0, 0, 0, { 0 } };
+
+static APILOG_TLS unsigned long apilog_tid = 0;
+static unsigned long volatile apilog_ntids = 0;
+
+
+/* Must be called with `apilog_chrome.lock` held. */
+APILOG_API void apilog_chrome_flush( void ) {
+    if( apilog_chrome.n > 0 && apilog_chrome.f != NULL )
+        fwrite( apilog_chrome.data, 1, apilog_chrome.n, apilog_chrome.f );
+    apilog_chrome.n = 0;
+}
+
+
+/* Must be called with `apilog_chrome.lock` held. */
+APILOG_API void apilog_chrome_put( char const* s, size_t n ) {
+    if( sizeof( apilog_chrome.data ) - apilog_chrome.n < n )
+        apilog_chrome_flush();
+    if( n > sizeof( apilog_chrome.data ) )
+        n = sizeof( apilog_chrome.data );
+    memcpy( apilog_chrome.data + apilog_chrome.n, s, n );
+    apilog_chrome.n += n;
+}
+
+
+/* Writes the contents of `s` as part of a JSON string. */
+APILOG_API void apilog_chrome_str( char const* s ) {
+    for( ; *s != '\0'; ++s ) {
+        if( *s == '"' || *s == '\\' )
+            apilog_chrome_put( "\\", 1 );
+        if( (unsigned char)*s >= 0x20 )
+            apilog_chrome_put( s, 1 );
+    }
+}
+
+
+/* Writes `u`, or `u/1000` with three decimals if `frac` is true. */
+APILOG_API void apilog_chrome_num( apilog_ticks u, int frac ) {
+    char num[ 32 ];
+    char* p = num + sizeof( num );
+    int i = 0;
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+        if( frac && ++i == 3 )
+            *--p = '.';
+    } while( u > 0 || (frac && i < 4) );
+    apilog_chrome_put( p, (size_t)(num + sizeof( num ) - p) );
+}
+
+
+/* Closes the JSON array with a metadata event. */
+APILOG_API void apilog_chrome_close( void ) {
+    APILOG_LOCK( apilog_chrome.lock );
+    if( apilog_chrome.f != NULL ) {
+        apilog_chrome_put( "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":", 38 );
+        apilog_chrome_num( (apilog_ticks)APILOG_GETPID(), 0 );
+        apilog_chrome_put( ",\"args\":{\"name\":\"apilog\"}}\n]\n", 29 );
+        apilog_chrome_flush();
+        fclose( apilog_chrome.f );
+        apilog_chrome.f = NULL;
+    }
+    APILOG_UNLOCK( apilog_chrome.lock );
+}
+
+
+APILOG_API void apilog_chrome_event( lua_State* L,
+                                     apilog_site const* site,
+                                     apilog_ticks start,
+                                     apilog_ticks t ) {
+    char num[ 24 ];
+    char* p = NULL;
+    size_t a = (size_t)L;
+    int top = lua_gettop( L );
+#if defined( APILOG_COROUTINES )
+    apilog_state* st = apilog_state_get( L );
+    lua_State* parent = st != NULL ? st->parent : NULL;
+#endif
+    if( apilog_tid == 0 ) {
+#if defined( __GNUC__ )
+        apilog_tid = __sync_add_and_fetch( &apilog_ntids, 1 );
+#else
+        apilog_tid = ++apilog_ntids;
+#endif
+    }
+    APILOG_LOCK( apilog_chrome.lock );
+    if( !apilog_chrome.registered ) {
+        apilog_chrome.registered = 1;
+        apilog_chrome.f = fopen( APILOG_CHROME_FILE, "w" );
+        if( apilog_chrome.f != NULL ) {
+            setvbuf( apilog_chrome.f, NULL, _IONBF, 0 );
+            apilog_chrome_put( "[\n", 2 );
+            atexit( apilog_chrome_close );
+        }
+    }
+    if( apilog_chrome.f != NULL ) {
+        apilog_chrome_put( "{\"name\":\"", 9 );
+        apilog_chrome_str( site->api );
+        apilog_chrome_put( "\",\"cat\":\"apilog\",\"ph\":\"X\",\"ts\":", 31 );
+        apilog_chrome_num( start, 1 );
+        apilog_chrome_put( ",\"dur\":", 7 );
+        apilog_chrome_num( t, 1 );
+        apilog_chrome_put( ",\"pid\":", 7 );
+        apilog_chrome_num( (apilog_ticks)APILOG_GETPID(), 0 );
+        apilog_chrome_put( ",\"tid\":", 7 );
+        apilog_chrome_num( (apilog_ticks)a, 0 );
+        apilog_chrome_put( ",\"args\":{\"thread\":", 18 );
+        apilog_chrome_num( (apilog_ticks)apilog_tid, 0 );
+#if defined( APILOG_COROUTINES )
+        if( parent != NULL ) {
+            apilog_chrome_put( ",\"parent\":", 10 );
+            apilog_chrome_num( (apilog_ticks)(size_t)parent, 0 );
+        }
+#endif
+        apilog_chrome_put( ",\"func\":\"", 9 );
+        apilog_chrome_str( site->func );
+        apilog_chrome_put( "\",\"site\":\"", 10 );
+        apilog_chrome_str( site->filename );
+        num[ sizeof( num )-1 ] = '"';
+        p = apilog_fmtint( num + sizeof( num )-1, site->lineno );
+        *--p = ':';
+        apilog_chrome_put( p, (size_t)(num + sizeof( num ) - p) );
+        apilog_chrome_put( ",\"top\":", 7 );
+        p = apilog_fmtint( num + sizeof( num ), top );
+        apilog_chrome_put( p, (size_t)(num + sizeof( num ) - p) );
+        apilog_chrome_put( "}},\n", 4 );
+    }
+    APILOG_UNLOCK( apilog_chrome.lock );
+}
+#endif /* APILOG_CHROME */
+
+
+#if defined( APILOG_ALLOC )
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef APILOG_ALLOC_TOP
+#define APILOG_ALLOC_TOP 20
+#endif
+
+#ifndef APILOG_ALLOC_DEPTH
+#define APILOG_ALLOC_DEPTH 64
+#endif
+
+/* The wrapped API calls running on a Lua universe. An entry whose
+ * wrapper is not above the current code on the C stack has been
+ * skipped by a `longjmp()` (an error or a yield) and is dropped. */
+typedef struct {
+    void const* sp; /* the `apilog_frame` of the wrapper */
+    apilog_site* site;
+} apilog_allocframe;
+
+/* apilog replaces the allocator of every Lua universe it sees with a
+ * wrapper that attributes allocated and freed bytes to the innermost
+ * wrapped API call that is currently running on that universe. The
+ * wrapper is never freed, because the original allocator is needed
+ * until the very last free of `lua_close()`. */
+typedef struct {
+    lua_Alloc f;
+    void* ud;
+    apilog_allocframe frames[ APILOG_ALLOC_DEPTH ];
+    int n;
+} apilog_allocator;
+
+static apilog_site apilog_othersite;
+static int apilog_allocating = 0;
+
+
+static void* apilog_alloc( void* ud, void* ptr, size_t osize, size_t nsize ) {
+    apilog_allocator* a = (apilog_allocator*)ud;
+    apilog_site* site = &apilog_othersite;
+    void* p = NULL;
+    while( a->n > 0 && !APILOG_DEEPER( &p, a->frames[ a->n-1 ].sp ) )
+        a->n--;
+    if( a->n > 0 && a->frames[ a->n-1 ].site != NULL )
+        site = a->frames[ a->n-1 ].site;
+    p = a->f( a->ud, ptr, osize, nsize );
+    if( ptr == NULL )
+        osize = 0; /* `osize` encodes the type of the new object */
+    if( nsize == 0 ) {
+        if( ptr != NULL ) {
+            APILOG_ADD( site->nfrees, 1 );
+            APILOG_ADD( site->fbytes, osize );
+        }
+    } else if( p != NULL ) {
+        if( nsize > osize ) {
+            APILOG_ADD( site->nallocs, 1 );
+            APILOG_ADD( site->abytes, nsize - osize );
+        } else
+            APILOG_ADD( site->fbytes, osize - nsize );
+    }
+    return p;
+}
+
+
+APILOG_API int apilog_alloc_keep( apilog_site const* s ) {
+    return s->nallocs > 0 || s->nfrees > 0;
+}
+
+
+APILOG_API int apilog_alloc_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->abytes < sb->abytes ? 1 : (sa->abytes > sb->abytes ? -1 : 0);
+}
+
+
+APILOG_API int apilog_alloc_cmpn( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->nallocs < sb->nallocs ? 1 :
+           (sa->nallocs > sb->nallocs ? -1 : 0);
+}
+
+
+APILOG_API void apilog_alloc_row( FILE* out, apilog_site const* s ) {
+    fprintf( out, "%10lu %12lu %10lu %12lu  ", s->nallocs, s->abytes,
+             s->nfrees, s->fbytes );
+    if( s == &apilog_othersite )
+        fputs( "(outside of wrapped API calls)\n", out );
+    else
+        fprintf( out, "%s in %s@%s:%d\n", s->api, s->func,
+                 s->filename, s->lineno );
+}
+
+
+/* Writes the APILOG_ALLOC_TOP call sites that allocated the most
+ * bytes, and the APILOG_ALLOC_TOP call sites with the most
+ * allocations. */
+APILOG_API void apilog_alloc_report( FILE* out ) {
+    size_t n = 0;
+    size_t i = 0;
+    apilog_site** sites = apilog_site_list( apilog_alloc_keep,
+                                            apilog_alloc_cmp,
+                                            &apilog_othersite, &n );
+    if( sites == NULL )
+        return;
+    fprintf( out, "%10s %12s %10s %12s  call site (by allocated bytes)\n",
+             "allocs", "bytes", "frees", "freed" );
+    for( i = 0; i < n && i < APILOG_ALLOC_TOP; ++i )
+        apilog_alloc_row( out, sites[ i ] );
+    fprintf( out, "%10s %12s %10s %12s  call site (by allocations)\n",
+             "allocs", "bytes", "frees", "freed" );
+    qsort( sites, n, sizeof( *sites ), apilog_alloc_cmpn );
+    for( i = 0; i < n && i < APILOG_ALLOC_TOP; ++i )
+        apilog_alloc_row( out, sites[ i ] );
+    free( sites );
+}
+
+
+APILOG_API void apilog_alloc_atexit( void ) {
+    apilog_alloc_report( stderr );
+}
+
+
+/* Makes `site` the current call site for allocations on the
+ * universe of `L` and installs the allocator wrapper if necessary.
+ * Returns the index of the new entry (or -1) and its allocator for
+ * `apilog_alloc_leave()`. */
+APILOG_API int apilog_alloc_enter( lua_State* L, apilog_site* site,
+                                   void const* sp,
+                                   apilog_allocator** pa ) {
+    apilog_allocator* a = NULL;
+    void* ud = NULL;
+    if( lua_getallocf( L, &ud ) == apilog_alloc )
+        a = (apilog_allocator*)ud;
+    else {
+        a = (apilog_allocator*)malloc( sizeof( *a ) );
+        if( a != NULL ) {
+            a->f = lua_getallocf( L, &a->ud );
+            a->n = 0;
+            lua_setallocf( L, apilog_alloc, a );
+        }
+        apilog_atexit_once( &apilog_allocating, apilog_alloc_atexit );
+    }
+    *pa = a;
+    if( a == NULL )
+        return -1;
+    while( a->n > 0 && !APILOG_DEEPER( sp, a->frames[ a->n-1 ].sp ) )
+        a->n--;
+    if( a->n >= APILOG_ALLOC_DEPTH )
+        return -1;
+    a->frames[ a->n ].sp = sp;
+    a->frames[ a->n ].site = site;
+    return a->n++;
+}
+
+
+/* Drops the entry at `index` (and any stale entries above it). */
+APILOG_API void apilog_alloc_leave( apilog_allocator* a, int index,
+                                    void const* sp ) {
+    if( a != NULL && index >= 0 && index < a->n &&
+        a->frames[ index ].sp == sp )
+        a->n = index;
+}
+#endif /* APILOG_ALLOC */
+
+
+#if defined( APILOG_GC )
+#include <stdio.h>
+#include <stdlib.h>
+
+static int apilog_gcing = 0;
+
+
+/* Returns the size of the Lua heap in bytes, or -1. */
+APILOG_API long apilog_heap( lua_State* L ) {
+    int kb = lua_gc( L, LUA_GCCOUNT, 0 );
+    int b = lua_gc( L, LUA_GCCOUNTB, 0 );
+    if( kb < 0 || b < 0 )
+        return -1;
+    return (long)kb * 1024 + b;
+}
+
+
+APILOG_API int apilog_gc_keep( apilog_site const* s ) {
+    return s->gcruns > 0;
+}
+
+
+APILOG_API int apilog_gc_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->gctime < sb->gctime ? 1 : (sa->gctime > sb->gctime ? -1 : 0);
+}
+
+
+APILOG_API void apilog_gc_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%12s %10s %14s %12s %12s  call site (times in " APILOG_TICKS ")\n",
+                 "calls", "with gc", "gc time", "max", "freed bytes" );
+    else
+        fprintf( out, "%12llu %10llu %14llu %12llu %12llu  %s in %s@%s:%d\n",
+                 s->gcalls, s->gcruns, s->gctime, s->gcmax, s->gcfreed,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes all call sites where the Lua heap shrank during the API
+ * call (i.e. the garbage collector freed memory), most time spent in
+ * those calls first. */
+APILOG_API void apilog_gc_report( FILE* out ) {
+    apilog_site_report( out, apilog_gc_keep, apilog_gc_cmp, apilog_gc_row );
+}
+
+
+APILOG_API void apilog_gc_atexit( void ) {
+    apilog_gc_report( stderr );
+}
+
+
+/* `heap` is the heap size before the API call, `t` its duration. */
+APILOG_API void apilog_gc_add( lua_State* L, apilog_site* site,
+                               long heap, apilog_ticks t ) {
+    long now = apilog_heap( L );
+    apilog_atexit_once( &apilog_gcing, apilog_gc_atexit );
+    APILOG_ADD( site->gcalls, 1 );
+    if( heap >= 0 && now >= 0 && now < heap ) {
+        APILOG_ADD( site->gcruns, 1 );
+        APILOG_ADD( site->gctime, t );
+        APILOG_ADD( site->gcfreed, (apilog_ticks)(heap - now) );
+        apilog_max( &site->gcmax, t );
+    }
+}
+#endif /* APILOG_GC */
+
+
+#if defined( APILOG_BUFSTATS )
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef APILOG_BUFSLOTS
+#define APILOG_BUFSLOTS 16
+#endif
+
+#if LUA_VERSION_NUM == 501
+/* Lua 5.1 moves full buffers to the stack */
+#define APILOG_BUFCAP( B ) ((unsigned long)(B)->lvl)
+#else
+#define APILOG_BUFCAP( B ) ((unsigned long)(B)->size)
+#endif
+
+/* Statistics of a `luaL_Buffer` go to the call site of its
+ * `luaL_buffinit()` (if that was logged on the same thread), or to the
+ * call site of the buffer operation itself. */
+static APILOG_TLS struct {
+    luaL_Buffer* B;
+    apilog_site* site;
+} apilog_bufs[ APILOG_BUFSLOTS ];
+static APILOG_TLS unsigned apilog_nextbuf = 0;
+static int apilog_buffering = 0;
+static int volatile apilog_buflock = 0;
+
+
+APILOG_API int apilog_buf_keep( apilog_site const* s ) {
+    return s->builds > 0 || s->grows > 0 || s->copied > 0;
+}
+
+
+APILOG_API int apilog_buf_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->grows < sb->grows ? 1 : (sa->grows > sb->grows ? -1 :
+           (sa->copied < sb->copied ? 1 : (sa->copied > sb->copied ? -1 : 0)));
+}
+
+
+APILOG_API void apilog_buf_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%10s %10s %10s %10s %14s  call site\n",
+                 "results", "avg size", "max size", "grows", "copied" );
+    else
+        fprintf( out, "%10lu %10lu %10lu %10lu %14lu  %s in %s@%s:%d\n",
+                 s->builds, s->builds > 0 ? s->bsize / s->builds : 0,
+                 s->bmax, s->grows, s->copied,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes the number of finished buffers, their average and maximum
+ * final size, how often they outgrew their storage, and the number of
+ * bytes copied into them for every call site, buffers that grew most
+ * often first. */
+APILOG_API void apilog_buffer_report( FILE* out ) {
+    apilog_site_report( out, apilog_buf_keep, apilog_buf_cmp,
+                        apilog_buf_row );
+}
+
+
+APILOG_API void apilog_buffer_atexit( void ) {
+    apilog_buffer_report( stderr );
+}
+
+
+APILOG_API apilog_site* apilog_buf_site( char const* func,
+                                         apilog_callsite const* cs,
+                                         luaL_Buffer* B,
+                                         int release ) {
+    unsigned i = 0;
+    for( i = 0; i < APILOG_BUFSLOTS; ++i ) {
+        if( apilog_bufs[ i ].B == B && B != NULL ) {
+            if( release )
+                apilog_bufs[ i ].B = NULL;
+            return apilog_bufs[ i ].site;
+        }
+    }
+    return func && cs ? apilog_site_get( cs, func ) : NULL;
+}
+
+
+APILOG_API void apilog_buf_init( char const* func,
+                                 apilog_callsite const* cs,
+                                 luaL_Buffer* B ) {
+    apilog_site* site = NULL;
+    unsigned i = 0;
+    if( !func || !cs || (site = apilog_site_get( cs, func )) == NULL )
+        return;
+    apilog_atexit_once( &apilog_buffering, apilog_buffer_atexit );
+    for( i = 0; i < APILOG_BUFSLOTS; ++i )
+        if( apilog_bufs[ i ].B == B )
+            break;
+    if( i == APILOG_BUFSLOTS )
+        i = apilog_nextbuf++ % APILOG_BUFSLOTS;
+    apilog_bufs[ i ].B = B;
+    apilog_bufs[ i ].site = site;
+}
+
+
+/* `cap` is APILOG_BUFCAP( B ) before the operation. */
+APILOG_API void apilog_buf_op( char const* func,
+                               apilog_callsite const* cs,
+                               luaL_Buffer* B,
+                               unsigned long cap,
+                               size_t n ) {
+    apilog_site* site = apilog_buf_site( func, cs, B, 0 );
+    if( site != NULL ) {
+        if( APILOG_BUFCAP( B ) != cap )
+            APILOG_ADD( site->grows, 1 );
+        APILOG_ADD( site->copied, n );
+    }
+}
+
+
+/* Called after the buffer contents have been pushed as a string. */
+APILOG_API void apilog_buf_done( char const* func,
+                                 apilog_callsite const* cs,
+                                 luaL_Buffer* B ) {
+    apilog_site* site = apilog_buf_site( func, cs, B, 1 );
+    size_t n = 0;
+    if( site != NULL ) {
+        lua_tolstring( B->L, -1, &n );
+        APILOG_ADD( site->builds, 1 );
+        APILOG_ADD( site->bsize, n );
+        APILOG_LOCK( apilog_buflock );
+        if( n > site->bmax )
+            site->bmax = n;
+        APILOG_UNLOCK( apilog_buflock );
+    }
+}
+
+
+APILOG_API size_t apilog_buf_toplen( lua_State* L ) {
+    size_t n = 0;
+    lua_tolstring( L, -1, &n );
+    return n;
+}
+
+#define APILOG_BUF_INIT( func, cs, B ) apilog_buf_init( (func), (cs), (B) )
+#define APILOG_BUF_OP( func, cs, B, cap, n ) \
+    apilog_buf_op( (func), (cs), (B), (cap), (n) )
+#define APILOG_BUF_DONE( func, cs, B ) apilog_buf_done( (func), (cs), (B) )
+#define APILOG_BUF_TOPLEN( L ) apilog_buf_toplen( L )
+#else
+#define APILOG_BUFCAP( B ) 0ul
+#define APILOG_BUF_INIT( func, cs, B ) ((void)0)
+#define APILOG_BUF_OP( func, cs, B, cap, n ) ((void)(cap), (void)(n))
+#define APILOG_BUF_DONE( func, cs, B ) ((void)0)
+#define APILOG_BUF_TOPLEN( L ) 0
+#endif /* APILOG_BUFSTATS */
+
+
+#if defined( APILOG_COROUTINES )
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Coroutine statistics are collected for the call site of the
+ * `lua_newthread()` that created the coroutine, or for the call site
+ * of the `lua_resume()` if the coroutine was created elsewhere. */
+static int apilog_coroutines = 0;
+
+
+APILOG_API int apilog_co_keep( apilog_site const* s ) {
+    return s->threads > 0 || s->resumes > 0 || s->moved > 0;
+}
+
+
+APILOG_API int apilog_co_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->runtime < sb->runtime ? 1 :
+           (sa->runtime > sb->runtime ? -1 : 0);
+}
+
+
+APILOG_API void apilog_co_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%8s %10s %10s %14s %12s %14s %10s  call site (times in " APILOG_TICKS ")\n",
+                 "threads", "resumes", "yields", "run time", "max run",
+                 "suspended", "moved" );
+    else
+        fprintf( out, "%8lu %10lu %10lu %14llu %12llu %14llu %10lu  %s in %s@%s:%d\n",
+                 s->threads, s->resumes, s->yields, s->runtime, s->maxrun,
+                 s->waittime, s->moved,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes the number of coroutines created, resumes, and yields, the
+ * total and maximum time spent running in `lua_resume()`, the total
+ * time between a yield and the next resume, and the number of values
+ * moved via `lua_xmove()` for every call site. */
+APILOG_API void apilog_coroutine_report( FILE* out ) {
+    apilog_site_report( out, apilog_co_keep, apilog_co_cmp, apilog_co_row );
+}
+
+
+APILOG_API void apilog_coroutine_atexit( void ) {
+    apilog_coroutine_report( stderr );
+}
+
+
+APILOG_API apilog_state* apilog_co_state( lua_State* co ) {
+    apilog_atexit_once( &apilog_coroutines, apilog_coroutine_atexit );
+    return co != NULL ? apilog_state_get( co ) : NULL;
+}
+
+
+APILOG_API void apilog_co_new( char const* func,
+                               apilog_callsite const* cs,
+                               lua_State* L,
+                               lua_State* co ) {
+    apilog_state* s = NULL;
+    apilog_site* site = NULL;
+    if( !func || !cs || (site = apilog_site_get( cs, func )) == NULL ||
+        (s = apilog_co_state( co )) == NULL )
+        return;
+    s->parent = L;
+    s->origin = site;
+    s->suspended = 0;
+    APILOG_ADD( site->threads, 1 );
+}
+
+
+APILOG_API apilog_site* apilog_co_site( char const* func,
+                                        apilog_callsite const* cs,
+                                        apilog_state* s ) {
+    if( s->origin != NULL )
+        return s->origin;
+    return func && cs ? apilog_site_get( cs, func ) : NULL;
+}
+
+
+APILOG_API void apilog_co_resume( char const* func,
+                                  apilog_callsite const* cs,
+                                  lua_State* co,
+                                  lua_State* from ) {
+    apilog_state* s = apilog_co_state( co );
+    apilog_site* site = NULL;
+    if( s == NULL || (site = apilog_co_site( func, cs, s )) == NULL )
+        return;
+    if( from != NULL )
+        s->parent = from;
+    s->resumed = apilog_now();
+    if( s->suspended != 0 ) {
+        APILOG_ADD( site->waittime, s->resumed - s->suspended );
+        s->suspended = 0;
+    }
+}
+
+
+APILOG_API void apilog_co_resumed( char const* func,
+                                   apilog_callsite const* cs,
+                                   lua_State* co,
+                                   int status ) {
+    apilog_state* s = apilog_co_state( co );
+    apilog_site* site = NULL;
+    apilog_ticks now = apilog_now();
+    if( s == NULL || (site = apilog_co_site( func, cs, s )) == NULL )
+        return;
+    APILOG_ADD( site->resumes, 1 );
+    APILOG_ADD( site->runtime, now - s->resumed );
+    apilog_max( &site->maxrun, now - s->resumed );
+    if( status == LUA_YIELD ) {
+        APILOG_ADD( site->yields, 1 );
+        s->suspended = now;
+    }
+}
+
+
+APILOG_API void apilog_co_xmove( char const* func,
+                                 apilog_callsite const* cs,
+                                 lua_State* from,
+                                 lua_State* to,
+                                 int n ) {
+    apilog_state* s = apilog_co_state( from );
+    apilog_site* site = NULL;
+    if( s == NULL || s->origin == NULL )
+        s = apilog_co_state( to );
+    if( s != NULL && (site = apilog_co_site( func, cs, s )) != NULL )
+        APILOG_ADD( site->moved, (unsigned long)n );
+}
+
+#define APILOG_CO_NEW( func, cs, L, co ) \
+    apilog_co_new( (func), (cs), (L), (co) )
+#define APILOG_CO_RESUME( func, cs, co, from ) \
+    apilog_co_resume( (func), (cs), (co), (from) )
+#define APILOG_CO_RESUMED( func, cs, co, status ) \
+    apilog_co_resumed( (func), (cs), (co), (status) )
+#define APILOG_CO_XMOVE( func, cs, from, to, n ) \
+    apilog_co_xmove( (func), (cs), (from), (to), (n) )
+#else
+#define APILOG_CO_NEW( func, cs, L, co ) ((void)0)
+#define APILOG_CO_RESUME( func, cs, co, from ) ((void)0)
+#define APILOG_CO_RESUMED( func, cs, co, status ) ((void)0)
+#define APILOG_CO_XMOVE( func, cs, from, to, n ) ((void)0)
+#endif /* APILOG_COROUTINES */
+
+
+#if defined( APILOG_CHECKS )
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int apilog_checking = 0;
+
+typedef struct {
+    char const* func;
+    apilog_ticks calls;
+    apilog_ticks total;
+    size_t first;
+    size_t n;
+} apilog_cfunc;
+
+
+APILOG_API int apilog_check_keep( apilog_site const* s ) {
+    return s->ccalls > 0;
+}
+
+
+APILOG_API int apilog_check_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    int c = strcmp( sa->func, sb->func );
+    if( c != 0 )
+        return c;
+    return sa->ctotal < sb->ctotal ? 1 : (sa->ctotal > sb->ctotal ? -1 : 0);
+}
+
+
+APILOG_API int apilog_cfunc_cmp( void const* a, void const* b ) {
+    apilog_cfunc const* fa = (apilog_cfunc const*)a;
+    apilog_cfunc const* fb = (apilog_cfunc const*)b;
+    return fa->total < fb->total ? 1 : (fa->total > fb->total ? -1 : 0);
+}
+
+
+/* Writes the time spent in argument checks per C function (most
+ * expensive first), followed by the number of calls and the total,
+ * average, and maximum time of each of its argument checking call
+ * sites. */
+APILOG_API void apilog_check_report( FILE* out ) {
+    apilog_site** sites = NULL;
+    apilog_cfunc* funcs = NULL;
+    size_t n = 0;
+    size_t nf = 0;
+    size_t i = 0;
+    sites = apilog_site_list( apilog_check_keep, apilog_check_cmp, NULL, &n );
+    if( sites == NULL )
+        return;
+    if( (funcs = (apilog_cfunc*)malloc( (n+1) * sizeof( *funcs ) )) == NULL ) {
+        free( sites );
+        return;
+    }
+    for( i = 0; i < n; ++i ) {
+        if( nf == 0 || strcmp( funcs[ nf-1 ].func, sites[ i ]->func ) ) {
+            funcs[ nf ].func = sites[ i ]->func;
+            funcs[ nf ].calls = 0;
+            funcs[ nf ].total = 0;
+            funcs[ nf ].first = i;
+            funcs[ nf ].n = 0;
+            ++nf;
+        }
+        funcs[ nf-1 ].calls += sites[ i ]->ccalls;
+        funcs[ nf-1 ].total += sites[ i ]->ctotal;
+        funcs[ nf-1 ].n++;
+    }
+    qsort( funcs, nf, sizeof( *funcs ), apilog_cfunc_cmp );
+    fprintf( out, "%12s %14s %12s %12s  function / call site (times in " APILOG_TICKS ")\n",
+             "calls", "total", "average", "max" );
+    for( i = 0; i < nf; ++i ) {
+        size_t j = 0;
+        fprintf( out, "%12llu %14llu %12llu %12s  %s\n",
+                 funcs[ i ].calls, funcs[ i ].total,
+                 funcs[ i ].total / funcs[ i ].calls, "", funcs[ i ].func );
+        for( j = funcs[ i ].first; j < funcs[ i ].first+funcs[ i ].n; ++j ) {
+            apilog_site const* s = sites[ j ];
+            fprintf( out, "%12llu %14llu %12llu %12llu    %s@%s:%d\n",
+                     s->ccalls, s->ctotal, s->ctotal / s->ccalls, s->cmax,
+                     s->api, s->filename, s->lineno );
+        }
+    }
+    free( funcs );
+    free( sites );
+}
+
+
+APILOG_API void apilog_check_atexit( void ) {
+    apilog_check_report( stderr );
+}
+
+
+APILOG_API void apilog_check_add( apilog_site* site, apilog_ticks t ) {
+    apilog_atexit_once( &apilog_checking, apilog_check_atexit );
+    APILOG_ADD( site->ccalls, 1 );
+    APILOG_ADD( site->ctotal, t );
+    apilog_max( &site->cmax, t );
+}
+#endif /* APILOG_CHECKS */
+
+
+#if defined( APILOG_REFS )
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#ifndef APILOG_REF_BUCKETS
+#define APILOG_REF_BUCKETS 4096
+#endif
+
+/* A call site counts as growing after its number of live references
+ * has doubled this many times in a row (starting at 16) without
+ * dropping below half of the previous level in between. */
+#ifndef APILOG_REF_DOUBLINGS
+#define APILOG_REF_DOUBLINGS 3
+#endif
+
+/* Every table that references have been created in. */
+typedef struct apilog_reftab {
+    struct apilog_reftab* next;
+    void const* t;
+    int registry;
+    long live;
+    long peak;
+    unsigned long oldest;
+} apilog_reftab;
+
+/* A live reference created by an instrumented `luaL_ref()`. */
+typedef struct apilog_refent {
+    struct apilog_refent* next;
+    apilog_reftab* tab;
+    apilog_site* site;
+    int ref;
+    unsigned long created;
+} apilog_refent;
+
+static apilog_refent* apilog_refs[ APILOG_REF_BUCKETS ];
+static apilog_reftab* apilog_reftabs = NULL;
+static int apilog_refstats = 0;
+static int volatile apilog_reflock = 0;
+
+
+APILOG_API size_t apilog_ref_hash( void const* t, int ref ) {
+    return (((size_t)t >> 4) ^ ((size_t)ref * 2654435761u)) %
+           APILOG_REF_BUCKETS;
+}
+
+
+APILOG_API int apilog_ref_keep( apilog_site const* s ) {
+    return s->rmade > 0;
+}
+
+
+APILOG_API int apilog_ref_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->rlive < sb->rlive ? 1 : (sa->rlive > sb->rlive ? -1 : 0);
+}
+
+
+/* Writes the number of live references, their high-water mark, the
+ * number of created and released references, and the age of the
+ * oldest live reference for every `luaL_ref()` call site and for
+ * every table. Call sites whose live references keep growing are
+ * marked. */
+APILOG_API void apilog_ref_report( FILE* out ) {
+    apilog_site** sites = NULL;
+    apilog_reftab* tab = NULL;
+    unsigned long now = (unsigned long)time( NULL );
+    size_t n = 0;
+    size_t i = 0;
+    APILOG_LOCK( apilog_reflock );
+    sites = apilog_site_list( apilog_ref_keep, apilog_ref_cmp, NULL, &n );
+    if( sites == NULL ) {
+        APILOG_UNLOCK( apilog_reflock );
+        return;
+    }
+    for( i = 0; i < n; ++i )
+        sites[ i ]->roldest = now;
+    for( tab = apilog_reftabs; tab != NULL; tab = tab->next )
+        tab->oldest = now;
+    for( i = 0; i < APILOG_REF_BUCKETS; ++i ) {
+        apilog_refent* e = apilog_refs[ i ];
+        for( ; e != NULL; e = e->next ) {
+            if( e->created < e->site->roldest )
+                e->site->roldest = e->created;
+            if( e->created < e->tab->oldest )
+                e->tab->oldest = e->created;
+        }
+    }
+    fprintf( out, "%10s %10s %10s %10s %10s  call site\n",
+             "live", "peak", "created", "released", "oldest (s)" );
+    for( i = 0; i < n; ++i ) {
+        apilog_site const* s = sites[ i ];
+        fprintf( out, "%10ld %10ld %10lu %10lu %10lu  %s in %s@%s:%d%s\n",
+                 s->rlive, s->rpeak, s->rmade, s->rmade - (unsigned long)s->rlive,
+                 now - s->roldest, s->api, s->func, s->filename,
+                 s->lineno, s->rgrowths >= APILOG_REF_DOUBLINGS &&
+                 2*s->rlive > s->rbase ? "  (growing)" : "" );
+    }
+    fprintf( out, "%10s %10s %10s  table\n", "live", "peak", "oldest (s)" );
+    for( tab = apilog_reftabs; tab != NULL; tab = tab->next )
+        fprintf( out, "%10ld %10ld %10lu  %s%p\n", tab->live, tab->peak,
+                 now - tab->oldest, tab->registry ? "registry " : "",
+                 (void*)tab->t );
+    APILOG_UNLOCK( apilog_reflock );
+    free( sites );
+}
+
+
+APILOG_API void apilog_ref_atexit( void ) {
+    apilog_ref_report( stderr );
+}
+
 
+/* Has to be called before `luaL_ref()` pops the value, because `t`
+ * may be a relative index. */
+APILOG_API void const* apilog_ref_table( lua_State* L, int t ) {
+    return lua_topointer( L, t );
+}
 
-#ifndef __has_attribute
-#define __has_attribute( x ) 0
-#endif
 
-#ifndef APILOG_API
-#if defined( __GNUC__ ) || __has_attribute( __unused__ )
-#define APILOG_API __attribute__((__unused__)) static
+APILOG_API void apilog_ref_new( char const* func,
+                                apilog_callsite const* cs,
+                                void const* t,
+                                int registry,
+                                int ref ) {
+    apilog_site* site = NULL;
+    apilog_reftab* tab = NULL;
+    apilog_refent* e = NULL;
+    size_t h = apilog_ref_hash( t, ref );
+    if( !func || !cs || ref < 0 || t == NULL ||
+        (site = apilog_site_get( cs, func )) == NULL )
+        return;
+    apilog_atexit_once( &apilog_refstats, apilog_ref_atexit );
+    APILOG_LOCK( apilog_reflock );
+    for( tab = apilog_reftabs; tab != NULL; tab = tab->next )
+        if( tab->t == t )
+            break;
+    if( tab == NULL &&
+        (tab = (apilog_reftab*)calloc( 1, sizeof( *tab ) )) != NULL ) {
+        tab->t = t;
+        tab->registry = registry;
+        tab->next = apilog_reftabs;
+        apilog_reftabs = tab;
+    }
+    if( tab != NULL )
+        for( e = apilog_refs[ h ]; e != NULL; e = e->next )
+            if( e->ref == ref && e->tab == tab )
+                break;
+    if( e != NULL ) {
+        /* the old reference has been released behind our back, e.g.
+         * by a raw table operation, or because its table has been
+         * collected and a new table got the same address */
+        tab->live--;
+        if( --e->site->rlive < e->site->rlow )
+            e->site->rlow = e->site->rlive;
+    } else if( tab != NULL &&
+               (e = (apilog_refent*)malloc( sizeof( *e ) )) != NULL ) {
+        e->tab = tab;
+        e->ref = ref;
+        e->next = apilog_refs[ h ];
+        apilog_refs[ h ] = e;
+    }
+    if( e == NULL ) {
+        APILOG_UNLOCK( apilog_reflock );
+        return;
+    }
+    e->site = site;
+    e->created = (unsigned long)time( NULL );
+    if( ++tab->live > tab->peak )
+        tab->peak = tab->live;
+    site->rmade++;
+    if( ++site->rlive > site->rpeak )
+        site->rpeak = site->rlive;
+    if( site->rlive >= (site->rbase > 0 ? 2*site->rbase : 16) ) {
+        if( site->rbase > 0 && 2*site->rlow > site->rbase )
+            site->rgrowths++;
+        else
+            site->rgrowths = 0;
+        site->rbase = site->rlive;
+        site->rlow = site->rlive;
+    }
+    APILOG_UNLOCK( apilog_reflock );
+}
+
+
+APILOG_API void apilog_ref_free( void const* t, int ref ) {
+    apilog_refent** p = NULL;
+    apilog_refent* e = NULL;
+    if( ref < 0 || t == NULL )
+        return;
+    APILOG_LOCK( apilog_reflock );
+    for( p = apilog_refs + apilog_ref_hash( t, ref ); *p != NULL;
+         p = &(*p)->next ) {
+        if( (*p)->ref == ref && (*p)->tab->t == t ) {
+            e = *p;
+            *p = e->next;
+            e->tab->live--;
+            if( --e->site->rlive < e->site->rlow )
+                e->site->rlow = e->site->rlive;
+            break;
+        }
+    }
+    APILOG_UNLOCK( apilog_reflock );
+    free( e );
+}
+
+#define APILOG_REF_TABLE( L, t ) apilog_ref_table( (L), (t) )
+#define APILOG_REF_NEW( func, cs, p, t, ref ) \
+    apilog_ref_new( (func), (cs), (p), (t) == LUA_REGISTRYINDEX, (ref) )
+#define APILOG_REF_FREE( p, ref ) apilog_ref_free( (p), (ref) )
 #else
-#define APILOG_API static
-#endif
-#endif
+#define APILOG_REF_TABLE( L, t ) NULL
+#define APILOG_REF_NEW( func, cs, p, t, ref ) ((void)(p))
+#define APILOG_REF_FREE( p, ref ) ((void)(p))
+#endif /* APILOG_REFS */
 
 
-#ifndef APILOG_PRINT
-#define APILOG_PRINT
+#if defined( APILOG_PRESIZE )
 #include <stdio.h>
+#include <stdlib.h>
 
-APILOG_API void apilog_print( lua_State* L,
-                              char const* func,
-                              char const* filename,
-                              int lineno,
-                              char const* api ) {
-    if( func ) {
-        int top = lua_gettop( L );
-        int i = 0;
-        fprintf( stderr, "%s in %s@%s:%d:  [", api, func, filename, lineno );
-        for( i = 1; i <= top; ++i ) {
-            switch( lua_type( L, i ) ) {
-                case LUA_TNONE: /* fall through */
-                case LUA_TNIL: fputs( " n", stderr ); break;
-                case LUA_TBOOLEAN: fputs( " b", stderr ); break;
-                case LUA_TLIGHTUSERDATA: fputs( " l", stderr ); break;
-                case LUA_TNUMBER:
-#if LUA_VERSION_NUM >= 503
-                    if( lua_isinteger( L, i ) )
-                        fputs( " i", stderr );
-                    else
+/* Number of tables that are followed at the same time. A new table
+ * replaces an older one that maps to the same slot, and the older
+ * table counts as complete. */
+#ifndef APILOG_PRESIZE_SLOTS
+#define APILOG_PRESIZE_SLOTS 1024
+#endif
+
+/* Number of distinct keys remembered per table to recognize repeated
+ * stores to the same field. */
+#ifndef APILOG_PRESIZE_KEYS
+#define APILOG_PRESIZE_KEYS 16
 #endif
-                        fputs( " d", stderr );
+
+/* A followed table is identified by its stack slot and its address:
+ * once the slot has been popped or overwritten, the address may be
+ * reused by an unrelated table. */
+typedef struct {
+    void const* t;
+    lua_State* L;
+    int slot;
+    apilog_site* site;
+    unsigned long narr; /* requested sizes */
+    unsigned long nrec;
+    unsigned long acount; /* stores with positive integer keys */
+    unsigned long amax;
+    unsigned long hcount; /* stores to other (distinct) keys */
+    unsigned long asize; /* simulated sizes of the table parts */
+    unsigned long hsize;
+    unsigned long hused;
+    unsigned long rehashes;
+    int nkeys;
+    void const* keys[ APILOG_PRESIZE_KEYS ];
+} apilog_tracked;
+
+static apilog_tracked apilog_tracked_tables[ APILOG_PRESIZE_SLOTS ];
+static int apilog_presizing = 0;
+static int volatile apilog_presizelock = 0;
+
+
+APILOG_API unsigned long apilog_pow2( unsigned long n ) {
+    unsigned long s = 0;
+    while( s < n )
+        s = s > 0 ? 2*s : 1;
+    return s;
+}
+
+
+/* Simulates the growth of a tracked table for a new key (`n` is a
+ * positive integer key or 0). Like Lua, a key that doesn't fit into
+ * the array part goes to the hash part, and when that is full, one
+ * rehash computes new sizes for both parts. */
+APILOG_API void apilog_presize_insert( apilog_tracked* tr,
+                                       unsigned long n ) {
+    unsigned long narr = 0;
+    unsigned long a = 0;
+    if( n > 0 && n <= tr->asize )
+        return;
+    if( tr->hused < tr->hsize ) {
+        tr->hused++;
+        return;
+    }
+    tr->rehashes++;
+    narr = tr->acount < tr->amax ? tr->acount : tr->amax;
+    a = apilog_pow2( tr->amax );
+    if( 2*narr > a )
+        tr->asize = a;
+    tr->hused = narr + tr->hcount -
+                (narr < tr->asize ? narr : tr->asize);
+    tr->hsize = apilog_pow2( tr->hused );
+}
+
+
+/* Adds the contents of a tracked table to the statistics of its
+ * call site. Integer keys only count for the array part if they
+ * would fill more than half of it. */
+APILOG_API void apilog_presize_fold( apilog_tracked* tr ) {
+    apilog_site* site = tr->site;
+    unsigned long narr = tr->acount < tr->amax ? tr->acount : tr->amax;
+    unsigned long nrec = tr->hcount;
+    if( 2*narr <= tr->amax ) {
+        nrec += narr;
+        narr = 0;
+    }
+    site->ptables++;
+    site->parr += narr;
+    site->prec += nrec;
+    if( narr > site->pmaxarr )
+        site->pmaxarr = narr;
+    if( nrec > site->pmaxrec )
+        site->pmaxrec = nrec;
+    site->prehash += tr->rehashes;
+    tr->t = NULL;
+}
+
+
+APILOG_API int apilog_presize_keep( apilog_site const* s ) {
+    return s->ptables > 0;
+}
+
+
+APILOG_API int apilog_presize_cmp( void const* a, void const* b ) {
+    apilog_site const* sa = *(apilog_site const* const*)a;
+    apilog_site const* sb = *(apilog_site const* const*)b;
+    return sa->prehash < sb->prehash ? 1 :
+           (sa->prehash > sb->prehash ? -1 : 0);
+}
+
+
+APILOG_API void apilog_presize_row( FILE* out, apilog_site const* s ) {
+    if( s == NULL )
+        fprintf( out, "%10s %8s %8s %8s %8s %10s  suggestion / call site\n",
+                 "tables", "avg arr", "max arr", "avg rec", "max rec",
+                 "rehashes" );
+    else
+        fprintf( out, "%10lu %8lu %8lu %8lu %8lu %10lu  lua_createtable( L, %lu, %lu ) for %s in %s@%s:%d\n",
+                 s->ptables, (s->parr + s->ptables - 1) / s->ptables,
+                 s->pmaxarr, (s->prec + s->ptables - 1) / s->ptables,
+                 s->pmaxrec, s->prehash, s->pmaxarr, s->pmaxrec,
+                 s->api, s->func, s->filename, s->lineno );
+}
+
+
+/* Writes the number of tables, the average and maximum number of
+ * array and hash entries stored into them, and the estimated number
+ * of rehashes for every table creating call site, together with the
+ * `lua_createtable()` call that would avoid those rehashes. Tables
+ * that are still followed are counted with their current contents. */
+APILOG_API void apilog_presize_report( FILE* out ) {
+    size_t i = 0;
+    APILOG_LOCK( apilog_presizelock );
+    for( i = 0; i < APILOG_PRESIZE_SLOTS; ++i )
+        if( apilog_tracked_tables[ i ].t != NULL )
+            apilog_presize_fold( apilog_tracked_tables + i );
+    APILOG_UNLOCK( apilog_presizelock );
+    apilog_site_report( out, apilog_presize_keep, apilog_presize_cmp,
+                        apilog_presize_row );
+}
+
+
+APILOG_API void apilog_presize_atexit( void ) {
+    apilog_presize_report( stderr );
+}
+
+
+APILOG_API size_t apilog_presize_slot( void const* t ) {
+    return ((size_t)t >> 4) % APILOG_PRESIZE_SLOTS;
+}
+
+
+/* Starts following the new table on top of the stack. */
+APILOG_API void apilog_table_new( char const* func,
+                                  apilog_callsite const* cs,
+                                  lua_State* L,
+                                  int narr,
+                                  int nrec ) {
+    apilog_site* site = NULL;
+    apilog_tracked* tr = NULL;
+    void const* t = lua_topointer( L, -1 );
+    if( !func || !cs || t == NULL ||
+        (site = apilog_site_get( cs, func )) == NULL )
+        return;
+    tr = apilog_tracked_tables + apilog_presize_slot( t );
+    apilog_atexit_once( &apilog_presizing, apilog_presize_atexit );
+    APILOG_LOCK( apilog_presizelock );
+    if( tr->t != NULL )
+        apilog_presize_fold( tr );
+    tr->t = t;
+    tr->L = L;
+    tr->slot = lua_gettop( L );
+    tr->site = site;
+    tr->narr = narr > 0 ? (unsigned long)narr : 0;
+    tr->nrec = nrec > 0 ? (unsigned long)nrec : 0;
+    tr->acount = 0;
+    tr->amax = 0;
+    tr->hcount = 0;
+    tr->asize = tr->narr;
+    tr->hsize = apilog_pow2( tr->nrec );
+    tr->hused = 0;
+    tr->rehashes = 0;
+    tr->nkeys = 0;
+    APILOG_UNLOCK( apilog_presizelock );
+}
+
+
+/* Counts a store of a non-nil value into the table at `index`, either
+ * with the positive integer key `n`, or with the key identified by
+ * `k` (`NULL` for keys that can't be identified). */
+APILOG_API void apilog_table_store( lua_State* L,
+                                    int index,
+                                    unsigned long n,
+                                    void const* k ) {
+    apilog_tracked* tr = NULL;
+    void const* t = NULL;
+    int i = 0;
+    if( lua_type( L, -1 ) == LUA_TNIL ||
+        (t = lua_topointer( L, index )) == NULL )
+        return;
+    tr = apilog_tracked_tables + apilog_presize_slot( t );
+    if( tr->t != t )
+        return;
+    APILOG_LOCK( apilog_presizelock );
+    if( tr->t == t ) {
+        if( tr->L != L || tr->slot > lua_gettop( L ) ||
+            lua_topointer( L, tr->slot ) != t ) {
+            /* the slot has been popped or overwritten */
+            apilog_presize_fold( tr );
+        } else if( n > 0 ) {
+            tr->acount++;
+            if( n > tr->amax )
+                tr->amax = n;
+            apilog_presize_insert( tr, n );
+        } else if( k == NULL ) {
+            tr->hcount++;
+            apilog_presize_insert( tr, 0 );
+        } else {
+            for( i = 0; i < tr->nkeys; ++i )
+                if( tr->keys[ i ] == k )
                     break;
-                case LUA_TSTRING: fputs( " s", stderr ); break;
-                case LUA_TTABLE: fputs( " t", stderr ); break;
-                case LUA_TFUNCTION: fputs( " f", stderr ); break;
-                case LUA_TUSERDATA: fputs( " u", stderr ); break;
-                case LUA_TTHREAD: fputs( " c", stderr ); break;
-                default:
-                  fputs( " ?", stderr ); break;
+            if( i == tr->nkeys ) {
+                tr->hcount++;
+                apilog_presize_insert( tr, 0 );
+                if( tr->nkeys < APILOG_PRESIZE_KEYS )
+                    tr->keys[ tr->nkeys++ ] = k;
             }
         }
-        fputs( " ]\n", stderr );
     }
+    APILOG_UNLOCK( apilog_presizelock );
 }
-#endif /* APILOG_PRINT */
+
+
+/* Like `apilog_table_store()`, but for the key below the value on
+ * the stack. */
+APILOG_API void apilog_table_set( lua_State* L, int index ) {
+    if( lua_type( L, -2 ) == LUA_TNUMBER ) {
+        lua_Number d = lua_tonumber( L, -2 );
+        if( d >= 1 && d < 1e9 && d == (lua_Number)(unsigned long)d )
+            apilog_table_store( L, index, (unsigned long)d, NULL );
+        else
+            apilog_table_store( L, index, 0, NULL );
+    } else if( lua_type( L, -2 ) == LUA_TSTRING )
+        apilog_table_store( L, index, 0, lua_tostring( L, -2 ) );
+    else
+        apilog_table_store( L, index, 0, lua_topointer( L, -2 ) );
+}
+
+#define APILOG_TABLE_NEW( func, cs, L, narr, nrec ) \
+    apilog_table_new( (func), (cs), (L), (narr), (nrec) )
+#define APILOG_TABLE_SETI( L, index, n ) \
+    apilog_table_store( (L), (index), \
+                        (n) > 0 ? (unsigned long)(n) : 0ul, NULL )
+#define APILOG_TABLE_SETK( L, index, k ) \
+    apilog_table_store( (L), (index), 0, (k) )
+#define APILOG_TABLE_SET( L, index ) apilog_table_set( (L), (index) )
+#else
+#define APILOG_TABLE_NEW( func, cs, L, narr, nrec ) ((void)0)
+#define APILOG_TABLE_SETI( L, index, n ) ((void)0)
+#define APILOG_TABLE_SETK( L, index, k ) ((void)0)
+#define APILOG_TABLE_SET( L, index ) ((void)0)
+#endif /* APILOG_PRESIZE */
+
+
+/* Every wrapper brackets the real API call with `apilog_begin()` and
+ * `apilog_end()`. The latter calls `apilog_print()`. */
+typedef struct {
+    char const* func;
+#if defined( APILOG_TIMING )
+    apilog_ticks start;
+#endif
+#if defined( APILOG_SUMMARY )
+    int top;
+#endif
+#if defined( APILOG_CALLTREE )
+    int depth;
+#endif
+#if defined( APILOG_ALLOC )
+    apilog_allocator* alloc;
+    int slot;
+#endif
+#if defined( APILOG_GC )
+    long heap;
+#endif
+} apilog_frame;
+
+
+APILOG_API void apilog_begin( apilog_frame* frame,
+                              char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L ) {
+    (void)L;
+    (void)cs;
+    frame->func = func;
+#if defined( APILOG_CALLTREE ) || defined( APILOG_ALLOC )
+    if( func && cs ) {
+        apilog_site* site = apilog_site_get( cs, func );
+#if defined( APILOG_CALLTREE )
+        frame->depth = site ? apilog_calltree_push( L, site, frame ) : -1;
+#endif
+#if defined( APILOG_ALLOC )
+        frame->slot = apilog_alloc_enter( L, site, frame, &frame->alloc );
+#endif
+    }
+#endif
+#if defined( APILOG_SUMMARY )
+    if( func )
+        frame->top = lua_gettop( L );
+#endif
+#if defined( APILOG_GC )
+    if( func )
+        frame->heap = apilog_heap( L );
+#endif
+#if defined( APILOG_TIMING )
+    if( func )
+        frame->start = apilog_now();
+#endif
+}
+
+
+#if defined( APILOG_PROFILE ) || defined( APILOG_HISTOGRAM ) || \
+    defined( APILOG_CHECKS ) || defined( APILOG_GC ) || \
+    defined( APILOG_RECORDER ) || defined( APILOG_SUMMARY ) || \
+    defined( APILOG_CALLTREE ) || defined( APILOG_ALLOC )
+/* statistics for every API call, whether it is logged or not */
+#define APILOG_ALWAYS
+#endif
+
+#ifndef APILOG_SKIP
+#define APILOG_SKIP() ((void)0)
+#endif
+
+
+APILOG_API void apilog_end( apilog_frame* frame,
+                            lua_State* L,
+                            char const* func,
+                            apilog_callsite const* cs ) {
+#if defined( APILOG_FILTER ) && !defined( APILOG_ALWAYS )
+    if( cs && APILOG_FILTERED( cs ) ) {
+        APILOG_SKIP();
+        return;
+    }
+#endif
+    if( func && cs ) {
+#if defined( APILOG_TIMING )
+        apilog_ticks t = apilog_now() - frame->start;
+#endif
+        apilog_site* site = apilog_site_get( cs, func );
+        unsigned long weight = 0;
+#if defined( APILOG_TIMING )
+        (void)t; /* e.g. APILOG_COROUTINES only needs the clock */
+#endif
+#if defined( APILOG_ALLOC )
+        apilog_alloc_leave( frame->alloc, frame->slot, frame );
+#endif
+#if defined( APILOG_CALLTREE )
+        apilog_calltree_pop( L, frame->depth, frame, t );
+#endif
+        if( site == NULL )
+            return;
+#if defined( APILOG_PROFILE )
+        apilog_profile_add( site, t );
+#endif
+#if defined( APILOG_HISTOGRAM )
+        apilog_histogram_add( site, t );
+#endif
+#if defined( APILOG_CHECKS )
+        if( site->flags & APILOG_SITE_CHECK )
+            apilog_check_add( site, t );
+#endif
+#if defined( APILOG_GC )
+        apilog_gc_add( L, site, frame->heap, t );
+#endif
+#if defined( APILOG_RECORDER )
+        apilog_record( L, site );
+#endif
+#if defined( APILOG_SUMMARY )
+        apilog_summary_add( L, site, frame->top );
+#endif
+        weight = APILOG_ENABLED( site );
+#if defined( APILOG_CHROME )
+        if( weight > 0 )
+            apilog_chrome_event( L, site, frame->start, t );
+#endif
+        APILOG_EMIT( L, site, weight );
+    }
+    (void)frame;
+}
+
+#endif /* APILOG_DECLARE_ONLY */
+
+
+/* Compile-time selection of the API functions to log. API functions
+ * that are not selected keep their original definitions. */
+#define APILOG_CAT_PUSH 0x001  /* lua_push*, lua_new*, lua_createtable */
+#define APILOG_CAT_GET 0x002   /* lua_get*, lua_rawget*, lua_next */
+#define APILOG_CAT_SET 0x004   /* lua_set*, lua_rawset* */
+#define APILOG_CAT_CALL 0x008  /* lua_(p)call, luaL_do*, ... */
+#define APILOG_CAT_LOAD 0x010  /* lua_load, luaL_load* */
+#define APILOG_CAT_STACK 0x020 /* lua_settop, lua_pop, lua_insert, ... */
+#define APILOG_CAT_MISC 0x040  /* lua_arith, lua_concat, lua_len, ... */
+#define APILOG_CAT_DEBUG 0x080 /* lua_getinfo, lua_getlocal, ... */
+#define APILOG_CAT_AUX 0x100   /* all other luaL_* functions */
+#define APILOG_CAT_CHECK 0x200 /* luaL_check*, luaL_opt*, luaL_testudata */
+#define APILOG_CAT_ALL 0x3FF
+
+/* The argument checking functions are called so often that they are
+ * only logged on request. */
+#ifndef APILOG_CATEGORIES
+#if defined( APILOG_ONLY_CALLS )
+#define APILOG_CATEGORIES APILOG_CAT_CALL
+#elif defined( APILOG_CHECKS )
+#define APILOG_CATEGORIES APILOG_CAT_ALL
+#else
+#define APILOG_CATEGORIES (APILOG_CAT_ALL & ~APILOG_CAT_CHECK)
+#endif
+#endif
+
+#if defined( APILOG_EXCLUDE_PUSH )
+#define APILOG_X_PUSH APILOG_CAT_PUSH
+#else
+#define APILOG_X_PUSH 0
+#endif
+#if defined( APILOG_EXCLUDE_GET )
+#define APILOG_X_GET APILOG_CAT_GET
+#else
+#define APILOG_X_GET 0
+#endif
+#if defined( APILOG_EXCLUDE_SET )
+#define APILOG_X_SET APILOG_CAT_SET
+#else
+#define APILOG_X_SET 0
+#endif
+#if defined( APILOG_EXCLUDE_CALL )
+#define APILOG_X_CALL APILOG_CAT_CALL
+#else
+#define APILOG_X_CALL 0
+#endif
+#if defined( APILOG_EXCLUDE_LOAD )
+#define APILOG_X_LOAD APILOG_CAT_LOAD
+#else
+#define APILOG_X_LOAD 0
+#endif
+#if defined( APILOG_EXCLUDE_STACK )
+#define APILOG_X_STACK APILOG_CAT_STACK
+#else
+#define APILOG_X_STACK 0
+#endif
+#if defined( APILOG_EXCLUDE_MISC )
+#define APILOG_X_MISC APILOG_CAT_MISC
+#else
+#define APILOG_X_MISC 0
+#endif
+#if defined( APILOG_EXCLUDE_DEBUG )
+#define APILOG_X_DEBUG APILOG_CAT_DEBUG
+#else
+#define APILOG_X_DEBUG 0
+#endif
+#if defined( APILOG_EXCLUDE_AUX )
+#define APILOG_X_AUX APILOG_CAT_AUX
+#else
+#define APILOG_X_AUX 0
+#endif
+#if defined( APILOG_EXCLUDE_CHECK )
+#define APILOG_X_CHECK APILOG_CAT_CHECK
+#else
+#define APILOG_X_CHECK 0
+#endif
+
+/* A wrapper for API function `x` is only defined if its category is
+ * selected and `APILOG_NO_x` is not defined. */
+#define APILOG_WANT( c ) \
+    ((APILOG_CATEGORIES) & APILOG_CAT_##c & ~(APILOG_X_PUSH | \
+      APILOG_X_GET | APILOG_X_SET | APILOG_X_CALL | APILOG_X_LOAD | \
+      APILOG_X_STACK | APILOG_X_MISC | APILOG_X_DEBUG | APILOG_X_AUX | \
+      APILOG_X_CHECK))
 
 
 #define apilog_func NULL
 
 
+#if APILOG_WANT( MISC ) && !defined( APILOG_NO_lua_arith )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilog_arith( char const* func,
-                              char const* filename,
-                              int lineno,
+                              apilog_callsite const* cs,
                               lua_State* L,
-                              int op ) {
+                              int op )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_arith( L, op );
-    apilog_print( L, func, filename, lineno, "lua_arith" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_arith
 #define lua_arith( L, op ) \
-    apilog_arith( apilog_func, __FILE__, __LINE__, (L), (op) )
+    apilog_arith( apilog_func, APILOG_CALLSITE( "lua_arith" ), (L), (op) )
+#endif
 #endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_call )
 APILOG_API void apilog_call( char const* func,
-                             char const* filename,
-                             int lineno,
+                             apilog_callsite const* cs,
                              lua_State* L,
                              int nargs,
-                             int nresults ) {
+                             int nresults )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_call( L, nargs, nresults );
-    apilog_print( L, func, filename, lineno, "lua_call" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_call
 #define lua_call( L, nargs, nresults ) \
-    apilog_call( apilog_func, __FILE__, __LINE__, (L), (nargs), (nresults) )
+    apilog_call( apilog_func, APILOG_CALLSITE( "lua_call" ), (L), (nargs), (nresults) )
+#endif
+
+
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_callk )
+#if LUA_VERSION_NUM >= 502
+APILOG_API void apilog_callk( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              int nargs,
+                              int nresults,
+#if LUA_VERSION_NUM >= 503
+                              lua_KContext ctx,
+                              lua_KFunction k )
+#else
+                              int ctx,
+                              lua_CFunction k )
+#endif
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    lua_callk( L, nargs, nresults, ctx, k );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef lua_callk
+#define lua_callk( L, nargs, nresults, ctx, k ) \
+    apilog_callk( apilog_func, APILOG_CALLSITE( "lua_callk" ), (L), (nargs), (nresults), (ctx), (k) )
+#endif
+#endif
 
 
+#if APILOG_WANT( MISC ) && !defined( APILOG_NO_lua_concat )
 APILOG_API void apilog_concat( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int n ) {
+                               int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_concat( L, n );
-    apilog_print( L, func, filename, lineno, "lua_concat" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_concat
 #define lua_concat( L, n ) \
-    apilog_concat( apilog_func, __FILE__, __LINE__, (L), (n) )
+    apilog_concat( apilog_func, APILOG_CALLSITE( "lua_concat" ), (L), (n) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_cpcall )
 #if LUA_VERSION_NUM == 501
 APILOG_API int apilog_cpcall( char const* func,
-                              char const* filename,
-                              int lineno,
+                              apilog_callsite const* cs,
                               lua_State* L,
                               lua_CFunction f,
-                              void* ud ) {
-    int result = lua_cpcall( L, f, ud );
-    apilog_print( L, func, filename, lineno, "lua_cpcall" );
+                              void* ud )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_cpcall( L, f, ud );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_cpcall
 #define lua_cpcall( L, f, ud ) \
-    apilog_cpcall( apilog_func, __FILE__, __LINE__, (L), (f), (ud) )
+    apilog_cpcall( apilog_func, APILOG_CALLSITE( "lua_cpcall" ), (L), (f), (ud) )
+#endif
 #endif
 
 
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_copy )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilog_copy( char const* func,
-                             char const* filename,
-                             int lineno,
+                             apilog_callsite const* cs,
                              lua_State* L,
                              int fromidx,
-                             int toidx ) {
+                             int toidx )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_copy( L, fromidx, toidx );
-    apilog_print( L, func, filename, lineno, "lua_copy" );
+    APILOG_HINT( toidx );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_copy
 #define lua_copy( L, fromidx, toidx ) \
-    apilog_copy( apilog_func, __FILE__, __LINE__, (L), (fromidx), (toidx) )
+    apilog_copy( apilog_func, APILOG_CALLSITE( "lua_copy" ), (L), (fromidx), (toidx) )
+#endif
 #endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_createtable )
 APILOG_API void apilog_createtable( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
                                     int narr,
-                                    int nrec ) {
+                                    int nrec )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_createtable( L, narr, nrec );
-    apilog_print( L, func, filename, lineno, "lua_createtable" );
+    APILOG_TABLE_NEW( func, cs, L, narr, nrec );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_createtable
 #define lua_createtable( L, narr, nrec ) \
-    apilog_createtable( apilog_func, __FILE__, __LINE__, (L), (narr), (nrec) )
+    apilog_createtable( apilog_func, APILOG_CALLSITE( "lua_createtable" ), (L), (narr), (nrec) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_getfenv )
 #if LUA_VERSION_NUM == 501
 APILOG_API void apilog_getfenv( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
-                                int index ) {
+                                int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_getfenv( L, index );
-    apilog_print( L, func, filename, lineno, "lua_getfenv" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_getfenv
 #define lua_getfenv( L, index ) \
-    apilog_getfenv( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_getfenv( apilog_func, APILOG_CALLSITE( "lua_getfenv" ), (L), (index) )
+#endif
 #endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_getfield )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_getfield( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 int index,
-                                char const* field ) {
-    int result = lua_getfield( L, index, field );
-    apilog_print( L, func, filename, lineno, "lua_getfield" );
+                                char const* field )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getfield( L, index, field );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_getfield( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
                                  int index,
-                                 char const* field ) {
+                                 char const* field )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_getfield( L, index, field );
-    apilog_print( L, func, filename, lineno, "lua_getfield" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_getfield
 #define lua_getfield( L, index, field ) \
-    apilog_getfield( apilog_func, __FILE__, __LINE__, (L), (index), (field) )
+    apilog_getfield( apilog_func, APILOG_CALLSITE( "lua_getfield" ), (L), (index), (field) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_getglobal )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_getglobal( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
-                                 char const* field ) {
-    int result = lua_getglobal( L, field );
-    apilog_print( L, func, filename, lineno, "lua_getglobal" );
+                                 char const* field )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getglobal( L, field );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_getglobal( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
-                                  char const* field ) {
+                                  char const* field )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_getglobal( L, field );
-    apilog_print( L, func, filename, lineno, "lua_getglobal" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_getglobal
 #define lua_getglobal( L, field ) \
-    apilog_getglobal( apilog_func, __FILE__, __LINE__, (L), (field) )
+    apilog_getglobal( apilog_func, APILOG_CALLSITE( "lua_getglobal" ), (L), (field) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_geti )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_geti( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
                             int index,
-                            lua_Integer i ) {
-    int result = lua_geti( L, index, i );
-    apilog_print( L, func, filename, lineno, "lua_geti" );
+                            lua_Integer i )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_geti( L, index, i );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_geti
 #define lua_geti( L, index, field ) \
-    apilog_geti( apilog_func, __FILE__, __LINE__, (L), (index), (field) )
+    apilog_geti( apilog_func, APILOG_CALLSITE( "lua_geti" ), (L), (index), (field) )
+#endif
 #endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_getmetatable )
 APILOG_API int apilog_getmetatable( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
-                                    int index ) {
-    int result = lua_getmetatable( L, index );
-    apilog_print( L, func, filename, lineno, "lua_getmetatable" );
+                                    int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getmetatable( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_getmetatable
 #define lua_getmetatable( L, index ) \
-    apilog_getmetatable( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_getmetatable( apilog_func, APILOG_CALLSITE( "lua_getmetatable" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_gettable )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_gettable( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
-                                int index ) {
-    int result = lua_gettable( L, index );
-    apilog_print( L, func, filename, lineno, "lua_gettable" );
+                                int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_gettable( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_gettable( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
-                                 int index ) {
+                                 int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_gettable( L, index );
-    apilog_print( L, func, filename, lineno, "lua_gettable" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_gettable
 #define lua_gettable( L, index ) \
-    apilog_gettable( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_gettable( apilog_func, APILOG_CALLSITE( "lua_gettable" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_getuservalue )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_getuservalue( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
-                                    int index ) {
-    int result = lua_getuservalue( L, index );
-    apilog_print( L, func, filename, lineno, "lua_getuservalue" );
+                                    int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getuservalue( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_getuservalue( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     int index ) {
+                                     int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_getuservalue( L, index );
-    apilog_print( L, func, filename, lineno, "lua_getuservalue" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_getuservalue
 #define lua_getuservalue( L, index ) \
-    apilog_getuservalue( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_getuservalue( apilog_func, APILOG_CALLSITE( "lua_getuservalue" ), (L), (index) )
+#endif
 #endif
 
 
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_insert )
 APILOG_API void apilog_insert( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int index ) {
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_insert( L, index );
-    apilog_print( L, func, filename, lineno, "lua_insert" );
+    APILOG_HINT( index );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_insert
 #define lua_insert( L, index ) \
-    apilog_insert( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_insert( apilog_func, APILOG_CALLSITE( "lua_insert" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( MISC ) && !defined( APILOG_NO_lua_len )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilog_len( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
-                            int index ) {
+                            int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_len( L, index );
-    apilog_print( L, func, filename, lineno, "lua_len" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_len
 #define lua_len( L, index ) \
-    apilog_len( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_len( apilog_func, APILOG_CALLSITE( "lua_len" ), (L), (index) )
+#endif
 #endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_lua_load )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilog_load( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
                             lua_Reader reader,
                             void* data,
                             char const* chunkname,
-                            char const* mode ) {
-    int result = lua_load( L, reader, data, chunkname, mode );
-    apilog_print( L, func, filename, lineno, "lua_load" );
+                            char const* mode )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_load( L, reader, data, chunkname, mode );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_load
 #define lua_load( L, reader, data, chunkname, mode ) \
-    apilog_load( apilog_func, __FILE__, __LINE__, (L), (reader), (data), (chunkname), (mode) )
+    apilog_load( apilog_func, APILOG_CALLSITE( "lua_load" ), (L), (reader), (data), (chunkname), (mode) )
 #else
 APILOG_API int apilog_load( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
                             lua_Reader reader,
                             void* data,
-                            char const* chunkname ) {
-    int result = lua_load( L, reader, data, chunkname );
-    apilog_print( L, func, filename, lineno, "lua_load" );
+                            char const* chunkname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_load( L, reader, data, chunkname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_load
 #define lua_load( L, reader, data, chunkname ) \
-    apilog_load( apilog_func, __FILE__, __LINE__, (L), (reader), (data), (chunkname) )
+    apilog_load( apilog_func, APILOG_CALLSITE( "lua_load" ), (L), (reader), (data), (chunkname) )
+#endif
 #endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_newtable )
 APILOG_API void apilog_newtable( char const* func,
-                                 char const* filename,
-                                 int lineno,
-                                 lua_State* L ) {
+                                 apilog_callsite const* cs,
+                                 lua_State* L )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_newtable( L );
-    apilog_print( L, func, filename, lineno, "lua_newtable" );
+    APILOG_TABLE_NEW( func, cs, L, 0, 0 );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_newtable
 #define lua_newtable( L ) \
-    apilog_newtable( apilog_func, __FILE__, __LINE__, (L) )
+    apilog_newtable( apilog_func, APILOG_CALLSITE( "lua_newtable" ), (L) )
+#endif
 
 
-APILOG_API void apilog_newthread( char const* func,
-                                  char const* filename,
-                                  int lineno,
-                                  lua_State* L ) {
-    lua_newthread( L );
-    apilog_print( L, func, filename, lineno, "lua_newthread" );
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_newthread )
+APILOG_API lua_State* apilog_newthread( char const* func,
+                                        apilog_callsite const* cs,
+                                        lua_State* L )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_newthread( L );
+    APILOG_CO_NEW( func, cs, L, result );
+    apilog_end( &frame, L, func, cs );
+    return result;
 }
+#endif
 #undef lua_newthread
 #define lua_newthread( L ) \
-    apilog_newthread( apilog_func, __FILE__, __LINE__, (L) )
+    apilog_newthread( apilog_func, APILOG_CALLSITE( "lua_newthread" ), (L) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_newuserdata )
 APILOG_API void* apilog_newuserdata( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     size_t size ) {
-    void* result = lua_newuserdata( L, size );
-    apilog_print( L, func, filename, lineno, "lua_newuserdata" );
+                                     size_t size )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    void* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_newuserdata( L, size );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_newuserdata
 #define lua_newuserdata( L, size ) \
-    apilog_newuserdata( apilog_func, __FILE__, __LINE__, (L), (size) )
+    apilog_newuserdata( apilog_func, APILOG_CALLSITE( "lua_newuserdata" ), (L), (size) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_next )
 APILOG_API int apilog_next( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
-                            int index ) {
-    int result = lua_next( L, index );
-    apilog_print( L, func, filename, lineno, "lua_next" );
+                            int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_next( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_next
 #define lua_next( L, index ) \
-    apilog_next( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_next( apilog_func, APILOG_CALLSITE( "lua_next" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_pcall )
 APILOG_API int apilog_pcall( char const* func,
-                             char const* filename,
-                             int lineno,
+                             apilog_callsite const* cs,
                              lua_State* L,
                              int nargs,
                              int nresults,
-                             int msgh ) {
-    int result = lua_pcall( L, nargs, nresults, msgh );
-    apilog_print( L, func, filename, lineno, "lua_pcall" );
+                             int msgh )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pcall( L, nargs, nresults, msgh );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_pcall
 #define lua_pcall( L, nargs, nresults, msgh ) \
-    apilog_pcall( apilog_func, __FILE__, __LINE__, (L), (nargs), (nresults), (msgh) )
+    apilog_pcall( apilog_func, APILOG_CALLSITE( "lua_pcall" ), (L), (nargs), (nresults), (msgh) )
+#endif
+
+
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_pcallk )
+#if LUA_VERSION_NUM >= 502
+APILOG_API int apilog_pcallk( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              int nargs,
+                              int nresults,
+                              int msgh,
+#if LUA_VERSION_NUM >= 503
+                              lua_KContext ctx,
+                              lua_KFunction k )
+#else
+                              int ctx,
+                              lua_CFunction k )
+#endif
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pcallk( L, nargs, nresults, msgh, ctx, k );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_pcallk
+#define lua_pcallk( L, nargs, nresults, msgh, ctx, k ) \
+    apilog_pcallk( apilog_func, APILOG_CALLSITE( "lua_pcallk" ), (L), (nargs), (nresults), (msgh), (ctx), (k) )
+#endif
+#endif
 
 
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_pop )
 APILOG_API void apilog_pop( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
-                            int n ) {
+                            int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pop( L, n );
-    apilog_print( L, func, filename, lineno, "lua_pop" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pop
 #define lua_pop( L, n ) \
-    apilog_pop( apilog_func, __FILE__, __LINE__, (L), (n) )
+    apilog_pop( apilog_func, APILOG_CALLSITE( "lua_pop" ), (L), (n) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushboolean )
 APILOG_API void apilog_pushboolean( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
-                                    int b ) {
+                                    int b )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushboolean( L, b );
-    apilog_print( L, func, filename, lineno, "lua_pushboolean" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushboolean
 #define lua_pushboolean( L, b ) \
-    apilog_pushboolean( apilog_func, __FILE__, __LINE__, (L), (b) )
+    apilog_pushboolean( apilog_func, APILOG_CALLSITE( "lua_pushboolean" ), (L), (b) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushcclosure )
 APILOG_API void apilog_pushcclosure( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
                                      lua_CFunction fn,
-                                     int n ) {
+                                     int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushcclosure( L, fn, n );
-    apilog_print( L, func, filename, lineno, "lua_pushcclosure" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushcclosure
 #define lua_pushcclosure( L, fn, n ) \
-    apilog_pushcclosure( apilog_func, __FILE__, __LINE__, (L), (fn), (n) )
+    apilog_pushcclosure( apilog_func, APILOG_CALLSITE( "lua_pushcclosure" ), (L), (fn), (n) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushcfunction )
 APILOG_API void apilog_pushcfunction( char const* func,
-                                      char const* filename,
-                                      int lineno,
+                                      apilog_callsite const* cs,
                                       lua_State* L,
-                                      lua_CFunction fn ) {
+                                      lua_CFunction fn )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushcfunction( L, fn );
-    apilog_print( L, func, filename, lineno, "lua_pushcfunction" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushcfunction
 #define lua_pushcfunction( L, fn ) \
-    apilog_pushcfunction( apilog_func, __FILE__, __LINE__, (L), (fn) )
+    apilog_pushcfunction( apilog_func, APILOG_CALLSITE( "lua_pushcfunction" ), (L), (fn) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushfstring )
 #if defined( __STDC_VERSION__ ) && __STDC_VERSION__+0 >= 199901L
 APILOG_API char const* apilog_pushfstring( char const* func,
-                                           char const* filename,
-                                           int lineno,
+                                           apilog_callsite const* cs,
                                            lua_State* L,
                                            char const* fmt,
-                                           ... ) {
+                                           ... )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
     char const* result = NULL;
     va_list argp;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     va_start( argp, fmt );
     result = (lua_pushvfstring)( L, fmt, argp );
     va_end( argp );
-    apilog_print( L, func, filename, lineno, "lua_pushfstring" );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_pushfstring
 #define lua_pushfstring( ... ) \
-    apilog_pushfstring( apilog_func, __FILE__, __LINE__, __VA_ARGS__ )
+    apilog_pushfstring( apilog_func, APILOG_CALLSITE( "lua_pushfstring" ), __VA_ARGS__ )
+#endif
 #endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushglobaltable )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilog_pushglobaltable( char const* func,
-                                        char const* filename,
-                                        int lineno,
-                                        lua_State* L ) {
+                                        apilog_callsite const* cs,
+                                        lua_State* L )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushglobaltable( L );
-    apilog_print( L, func, filename, lineno, "lua_pushglobaltable" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushglobaltable
 #define lua_pushglobaltable( L ) \
-    apilog_pushglobaltable( apilog_func, __FILE__, __LINE__, (L) )
+    apilog_pushglobaltable( apilog_func, APILOG_CALLSITE( "lua_pushglobaltable" ), (L) )
+#endif
 #endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushinteger )
 APILOG_API void apilog_pushinteger( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
-                                    lua_Integer n ) {
+                                    lua_Integer n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushinteger( L, n );
-    apilog_print( L, func, filename, lineno, "lua_pushinteger" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushinteger
 #define lua_pushinteger( L, n ) \
-    apilog_pushinteger( apilog_func, __FILE__, __LINE__, (L), (n) )
+    apilog_pushinteger( apilog_func, APILOG_CALLSITE( "lua_pushinteger" ), (L), (n) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushlightuserdata )
 APILOG_API void apilog_pushlightuserdata( char const* func,
-                                          char const* filename,
-                                          int lineno,
+                                          apilog_callsite const* cs,
                                           lua_State* L,
-                                          void* p ) {
+                                          void* p )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushlightuserdata( L, p );
-    apilog_print( L, func, filename, lineno, "lua_pushlightuserdata" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushlightuserdata
 #define lua_pushlightuserdata( L, p ) \
-    apilog_pushlightuserdata( apilog_func, __FILE__, __LINE__, (L), (p) )
+    apilog_pushlightuserdata( apilog_func, APILOG_CALLSITE( "lua_pushlightuserdata" ), (L), (p) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && \
+    !(defined( APILOG_NO_lua_pushliteral ) && defined( APILOG_NO_lua_pushlstring ))
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API char const* apilog_pushlstring( char const* func,
-                                           char const* filename,
-                                           int lineno,
-                                           char const* api,
+                                           apilog_callsite const* cs,
                                            lua_State* L,
                                            char const* s,
-                                           size_t len ) {
-    char const* result = lua_pushlstring( L, s, len );
-    apilog_print( L, func, filename, lineno, api );
+                                           size_t len )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pushlstring( L, s, len );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_pushlstring( char const* func,
-                                    char const* filename,
-                                    int lineno,
-                                    char const* api,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
                                     char const* s,
-                                    size_t len ) {
+                                    size_t len )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushlstring( L, s, len );
-    apilog_print( L, func, filename, lineno, api );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
+#ifndef APILOG_NO_lua_pushliteral
 #undef lua_pushliteral
-#undef lua_pushlstring
 #define lua_pushliteral( L, s ) \
-    apilog_pushlstring( apilog_func, __FILE__, __LINE__, "lua_pushliteral", (L), s "",  sizeof( s )-1 )
+    apilog_pushlstring( apilog_func, APILOG_CALLSITE( "lua_pushliteral" ), (L), s "",  sizeof( s )-1 )
+#endif
+#ifndef APILOG_NO_lua_pushlstring
+#undef lua_pushlstring
 #define lua_pushlstring( L, s, n ) \
-    apilog_pushlstring( apilog_func, __FILE__, __LINE__, "lua_pushlstring", (L), (s),  (n) )
+    apilog_pushlstring( apilog_func, APILOG_CALLSITE( "lua_pushlstring" ), (L), (s),  (n) )
+#endif
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushnil )
 APILOG_API void apilog_pushnil( char const* func,
-                                char const* filename,
-                                int lineno,
-                                lua_State* L ) {
+                                apilog_callsite const* cs,
+                                lua_State* L )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushnil( L );
-    apilog_print( L, func, filename, lineno, "lua_pushnil" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushnil
 #define lua_pushnil( L ) \
-    apilog_pushnil( apilog_func, __FILE__, __LINE__, (L) )
+    apilog_pushnil( apilog_func, APILOG_CALLSITE( "lua_pushnil" ), (L) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushnumber )
 APILOG_API void apilog_pushnumber( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
-                                   lua_Number n ) {
+                                   lua_Number n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushnumber( L, n );
-    apilog_print( L, func, filename, lineno, "lua_pushnumber" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushnumber
 #define lua_pushnumber( L, n ) \
-    apilog_pushnumber( apilog_func, __FILE__, __LINE__, (L), (n) )
+    apilog_pushnumber( apilog_func, APILOG_CALLSITE( "lua_pushnumber" ), (L), (n) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushstring )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API char const* apilog_pushstring( char const* func,
-                                          char const* filename,
-                                          int lineno,
+                                          apilog_callsite const* cs,
                                           lua_State* L,
-                                          char const* s ) {
-    char const* result = lua_pushstring( L, s );
-    apilog_print( L, func, filename, lineno, "lua_pushstring" );
+                                          char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pushstring( L, s );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_pushstring( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
-                                   char const* s ) {
+                                   char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushstring( L, s );
-    apilog_print( L, func, filename, lineno, "lua_pushstring" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_pushstring
 #define lua_pushstring( L, s ) \
-    apilog_pushstring( apilog_func, __FILE__, __LINE__, (L), (s) )
+    apilog_pushstring( apilog_func, APILOG_CALLSITE( "lua_pushstring" ), (L), (s) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushthread )
 APILOG_API int apilog_pushthread( char const* func,
-                                  char const* filename,
-                                  int lineno,
-                                  lua_State* L ) {
-    int result = lua_pushthread( L );
-    apilog_print( L, func, filename, lineno, "lua_pushthread" );
+                                  apilog_callsite const* cs,
+                                  lua_State* L )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pushthread( L );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_pushthread
 #define lua_pushthread( L ) \
-    apilog_pushthread( apilog_func, __FILE__, __LINE__, (L) )
+    apilog_pushthread( apilog_func, APILOG_CALLSITE( "lua_pushthread" ), (L) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushunsigned )
 #if LUA_VERSION_NUM == 502
 APILOG_API void apilog_pushunsigned( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     lua_Unsigned u ) {
+                                     lua_Unsigned u )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushunsigned( L, u );
-    apilog_print( L, func, filename, lineno, "lua_pushunsigned" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushunsigned
 #define lua_pushunsigned( L, u ) \
-    apilog_pushunsigned( apilog_func, __FILE__, __LINE__, (L), (u) )
+    apilog_pushunsigned( apilog_func, APILOG_CALLSITE( "lua_pushunsigned" ), (L), (u) )
+#endif
 #endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushvalue )
 APILOG_API void apilog_pushvalue( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
-                                  int value ) {
+                                  int value )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_pushvalue( L, value );
-    apilog_print( L, func, filename, lineno, "lua_pushvalue" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_pushvalue
 #define lua_pushvalue( L, value ) \
-    apilog_pushvalue( apilog_func, __FILE__, __LINE__, (L), (value) )
+    apilog_pushvalue( apilog_func, APILOG_CALLSITE( "lua_pushvalue" ), (L), (value) )
+#endif
 
 
+#if APILOG_WANT( PUSH ) && !defined( APILOG_NO_lua_pushvfstring )
 APILOG_API char const* apilog_pushvfstring( char const* func,
-                                            char const* filename,
-                                            int lineno,
+                                            apilog_callsite const* cs,
                                             lua_State* L,
                                             char const* fmt,
-                                            va_list ap ) {
-    char const* result = lua_pushvfstring( L, fmt, ap );
-    apilog_print( L, func, filename, lineno, "lua_pushvfstring" );
+                                            va_list ap )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_pushvfstring( L, fmt, ap );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_pushvfstring
 #define lua_pushvfstring( L, fmt, ap ) \
-    apilog_pushvfstring( apilog_func, __FILE__, __LINE__, (L), (fmt), (ap) )
+    apilog_pushvfstring( apilog_func, APILOG_CALLSITE( "lua_pushvfstring" ), (L), (fmt), (ap) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_rawget )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_rawget( char const* func,
-                              char const* filename,
-                              int lineno,
+                              apilog_callsite const* cs,
                               lua_State* L,
-                              int index ) {
-    int result = lua_rawget( L, index );
-    apilog_print( L, func, filename, lineno, "lua_rawget" );
+                              int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_rawget( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_rawget( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int index ) {
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_rawget( L, index );
-    apilog_print( L, func, filename, lineno, "lua_rawget" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_rawget
 #define lua_rawget( L, index ) \
-    apilog_rawget( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_rawget( apilog_func, APILOG_CALLSITE( "lua_rawget" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_rawgeti )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_rawgeti( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
                                int index,
-                               lua_Integer n ) {
-    int result = lua_rawgeti( L, index, n );
-    apilog_print( L, func, filename, lineno, "lua_rawgeti" );
+                               lua_Integer n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_rawgeti( L, index, n );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_rawgeti( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 int index,
-                                int n ) {
+                                int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_rawgeti( L, index, n );
-    apilog_print( L, func, filename, lineno, "lua_rawgeti" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_rawgeti
 #define lua_rawgeti( L, index, n ) \
-    apilog_rawgeti( apilog_func, __FILE__, __LINE__, (L), (index), (n) )
+    apilog_rawgeti( apilog_func, APILOG_CALLSITE( "lua_rawgeti" ), (L), (index), (n) )
+#endif
 
 
+#if APILOG_WANT( GET ) && !defined( APILOG_NO_lua_rawgetp )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilog_rawgetp( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
                                int index,
-                               void const* p ) {
-    int result = lua_rawgetp( L, index, p );
-    apilog_print( L, func, filename, lineno, "lua_rawgetp" );
+                               void const* p )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_rawgetp( L, index, p );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilog_rawgetp( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 int index,
-                                void const* p ) {
+                                void const* p )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_rawgetp( L, index, p );
-    apilog_print( L, func, filename, lineno, "lua_rawgetp" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef lua_rawgetp
 #define lua_rawgetp( L, index, p ) \
-    apilog_rawgetp( apilog_func, __FILE__, __LINE__, (L), (index), (p) )
+    apilog_rawgetp( apilog_func, APILOG_CALLSITE( "lua_rawgetp" ), (L), (index), (p) )
+#endif
 #endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_rawset )
 APILOG_API void apilog_rawset( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int index ) {
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SET( L, index );
     lua_rawset( L, index );
-    apilog_print( L, func, filename, lineno, "lua_rawset" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_rawset
 #define lua_rawset( L, index ) \
-    apilog_rawset( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_rawset( apilog_func, APILOG_CALLSITE( "lua_rawset" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_rawseti )
 APILOG_API void apilog_rawseti( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 int index,
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
@@ -790,682 +5919,1743 @@ APILOG_API void apilog_rawseti( char const* func,
 #else
                                 int n
 #endif
-                              ) {
+                              )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SETI( L, index, n );
     lua_rawseti( L, index, n );
-    apilog_print( L, func, filename, lineno, "lua_rawseti" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_rawseti
 #define lua_rawseti( L, index, n ) \
-    apilog_rawseti( apilog_func, __FILE__, __LINE__, (L), (index), (n) )
+    apilog_rawseti( apilog_func, APILOG_CALLSITE( "lua_rawseti" ), (L), (index), (n) )
+#endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_rawsetp )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilog_rawsetp( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 int index,
-                                void const* p ) {
+                                void const* p )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SETK( L, index, p );
     lua_rawsetp( L, index, p );
-    apilog_print( L, func, filename, lineno, "lua_rawsetp" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_rawsetp
 #define lua_rawsetp( L, index, p ) \
-    apilog_rawsetp( apilog_func, __FILE__, __LINE__, (L), (index), (p) )
+    apilog_rawsetp( apilog_func, APILOG_CALLSITE( "lua_rawsetp" ), (L), (index), (p) )
+#endif
 #endif
 
 
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_remove )
 APILOG_API void apilog_remove( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int index ) {
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_remove( L, index );
-    apilog_print( L, func, filename, lineno, "lua_remove" );
+    APILOG_HINT( index );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_remove
 #define lua_remove( L, index ) \
-    apilog_remove( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_remove( apilog_func, APILOG_CALLSITE( "lua_remove" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_replace )
 APILOG_API void apilog_replace( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
-                                int index ) {
+                                int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_replace( L, index );
-    apilog_print( L, func, filename, lineno, "lua_replace" );
+    APILOG_HINT( index );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_replace
 #define lua_replace( L, index ) \
-    apilog_replace( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_replace( apilog_func, APILOG_CALLSITE( "lua_replace" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_resume )
+#if LUA_VERSION_NUM >= 504
+APILOG_API int apilog_resume( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              lua_State* from,
+                              int narg,
+                              int* nres )
+#elif LUA_VERSION_NUM >= 502
+APILOG_API int apilog_resume( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              lua_State* from,
+                              int narg )
+#else
+APILOG_API int apilog_resume( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              int narg )
+#endif
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+#if LUA_VERSION_NUM >= 504
+    APILOG_CO_RESUME( func, cs, L, from );
+    result = lua_resume( L, from, narg, nres );
+#elif LUA_VERSION_NUM >= 502
+    APILOG_CO_RESUME( func, cs, L, from );
+    result = lua_resume( L, from, narg );
+#else
+    APILOG_CO_RESUME( func, cs, L, NULL );
+    result = lua_resume( L, narg );
+#endif
+    APILOG_CO_RESUMED( func, cs, L, result );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_resume
+#if LUA_VERSION_NUM >= 504
+#define lua_resume( L, from, narg, nres ) \
+    apilog_resume( apilog_func, APILOG_CALLSITE( "lua_resume" ), (L), (from), (narg), (nres) )
+#elif LUA_VERSION_NUM >= 502
+#define lua_resume( L, from, narg ) \
+    apilog_resume( apilog_func, APILOG_CALLSITE( "lua_resume" ), (L), (from), (narg) )
+#else
+#define lua_resume( L, narg ) \
+    apilog_resume( apilog_func, APILOG_CALLSITE( "lua_resume" ), (L), (narg) )
+#endif
+#endif
+
+
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_rotate )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API void apilog_rotate( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
                                int idx,
-                               int n ) {
+                               int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_rotate( L, idx, n );
-    apilog_print( L, func, filename, lineno, "lua_rotate" );
+    APILOG_HINT( idx );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_rotate
 #define lua_rotate( L, idx, n ) \
-    apilog_rotate( apilog_func, __FILE__, __LINE__, (L), (idx), (n) )
+    apilog_rotate( apilog_func, APILOG_CALLSITE( "lua_rotate" ), (L), (idx), (n) )
+#endif
 #endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_setfenv )
 #if LUA_VERSION_NUM == 501
 APILOG_API int apilog_setfenv( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int index ) {
-    int result = lua_setfenv( L, index );
-    apilog_print( L, func, filename, lineno, "lua_setfenv" );
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_setfenv( L, index );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef lua_setfenv
 #define lua_setfenv( L, index ) \
-    apilog_setfenv( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_setfenv( apilog_func, APILOG_CALLSITE( "lua_setfenv" ), (L), (index) )
+#endif
 #endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_setfield )
 APILOG_API void apilog_setfield( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
                                  int index,
-                                 char const* k ) {
+                                 char const* k )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SETK( L, index, k );
     lua_setfield( L, index, k );
-    apilog_print( L, func, filename, lineno, "lua_setfield" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_setfield
 #define lua_setfield( L, index, k ) \
-    apilog_setfield( apilog_func, __FILE__, __LINE__, (L), (index), (k) )
+    apilog_setfield( apilog_func, APILOG_CALLSITE( "lua_setfield" ), (L), (index), (k) )
+#endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_setglobal )
 APILOG_API void apilog_setglobal( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
-                                  char const* name ) {
+                                  char const* name )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_setglobal( L, name );
-    apilog_print( L, func, filename, lineno, "lua_setglobal" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_setglobal
 #define lua_setglobal( L, name ) \
-    apilog_setglobal( apilog_func, __FILE__, __LINE__, (L), (name) )
+    apilog_setglobal( apilog_func, APILOG_CALLSITE( "lua_setglobal" ), (L), (name) )
+#endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_seti )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API void apilog_seti( char const* func,
-                             char const* filename,
-                             int lineno,
+                             apilog_callsite const* cs,
                              lua_State* L,
                              int index,
-                             lua_Integer n ) {
+                             lua_Integer n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SETI( L, index, n );
     lua_seti( L, index, n );
-    apilog_print( L, func, filename, lineno, "lua_seti" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_seti
 #define lua_seti( L, index, n ) \
-    apilog_seti( apilog_func, __FILE__, __LINE__, (L), (index), (n) )
+    apilog_seti( apilog_func, APILOG_CALLSITE( "lua_seti" ), (L), (index), (n) )
+#endif
 #endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_setmetatable )
 APILOG_API void apilog_setmetatable( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     int index ) {
+                                     int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     lua_setmetatable( L, index );
-    apilog_print( L, func, filename, lineno, "lua_setmetatable" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef lua_setmetatable
 #define lua_setmetatable( L, index ) \
-    apilog_setmetatable( apilog_func, __FILE__, __LINE__, (L), (index) )
+    apilog_setmetatable( apilog_func, APILOG_CALLSITE( "lua_setmetatable" ), (L), (index) )
+#endif
 
 
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_settable )
 APILOG_API void apilog_settable( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
-                                 int index ) {
+                                 int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    APILOG_TABLE_SET( L, index );
     lua_settable( L, index );
-    apilog_print( L, func, filename, lineno, "lua_settable" );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef lua_settable
+#define lua_settable( L, index ) \
+    apilog_settable( apilog_func, APILOG_CALLSITE( "lua_settable" ), (L), (index) )
+#endif
+
+
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_settop )
+APILOG_API void apilog_settop( char const* func,
+                               apilog_callsite const* cs,
+                               lua_State* L,
+                               int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    lua_settop( L, index );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef lua_settop
+#define lua_settop( L, index ) \
+    apilog_settop( apilog_func, APILOG_CALLSITE( "lua_settop" ), (L), (index) )
+#endif
+
+
+#if APILOG_WANT( SET ) && !defined( APILOG_NO_lua_setuservalue )
+#if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
+APILOG_API void apilog_setuservalue( char const* func,
+                                     apilog_callsite const* cs,
+                                     lua_State* L,
+                                     int index )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    lua_setuservalue( L, index );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef lua_setuservalue
+#define lua_setuservalue( L, index ) \
+    apilog_setuservalue( apilog_func, APILOG_CALLSITE( "lua_setuservalue" ), (L), (index) )
+#endif
+#endif
+
+
+#if APILOG_WANT( MISC ) && !defined( APILOG_NO_lua_stringtonumber )
+#if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
+APILOG_API size_t apilog_stringtonumber( char const* func,
+                                         apilog_callsite const* cs,
+                                         lua_State* L,
+                                         char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    size_t result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_stringtonumber( L, s );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_stringtonumber
+#define lua_stringtonumber( L, s ) \
+    apilog_stringtonumber( apilog_func, APILOG_CALLSITE( "lua_stringtonumber" ), (L), (s) )
+#endif
+#endif
+
+
+#if APILOG_WANT( STACK ) && !defined( APILOG_NO_lua_xmove )
+APILOG_API void apilog_xmove( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* from,
+                              lua_State* to,
+                              int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, to );
+    lua_xmove( from, to, n );
+    APILOG_CO_XMOVE( func, cs, from, to, n );
+    apilog_end( &frame, to, func, cs );
+}
+#endif
+#undef lua_xmove
+#define lua_xmove( from, to, n ) \
+    apilog_xmove( apilog_func, APILOG_CALLSITE( "lua_xmove" ), (from), (to), (n) )
+#endif
+
+
+/* Since Lua 5.2 `lua_yield()` doesn't return to the caller (when
+ * called from a C function), so the log record is written before the
+ * yield. */
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_yield )
+APILOG_API int apilog_yield( char const* func,
+                             apilog_callsite const* cs,
+                             lua_State* L,
+                             int nresults )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    apilog_end( &frame, L, func, cs );
+    return lua_yield( L, nresults );
+}
+#endif
+#undef lua_yield
+#define lua_yield( L, nresults ) \
+    apilog_yield( apilog_func, APILOG_CALLSITE( "lua_yield" ), (L), (nresults) )
+#endif
+
+
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_lua_yieldk )
+#if LUA_VERSION_NUM >= 502
+APILOG_API int apilog_yieldk( char const* func,
+                              apilog_callsite const* cs,
+                              lua_State* L,
+                              int nresults,
+#if LUA_VERSION_NUM >= 503
+                              lua_KContext ctx,
+                              lua_KFunction k )
+#else
+                              int ctx,
+                              lua_CFunction k )
+#endif
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    apilog_end( &frame, L, func, cs );
+    return lua_yieldk( L, nresults, ctx, k );
+}
+#endif
+#undef lua_yieldk
+#define lua_yieldk( L, nresults, ctx, k ) \
+    apilog_yieldk( apilog_func, APILOG_CALLSITE( "lua_yieldk" ), (L), (nresults), (ctx), (k) )
+#endif
+#endif
+
+
+
+
+#if APILOG_WANT( DEBUG ) && !defined( APILOG_NO_lua_getinfo )
+APILOG_API int apilog_getinfo( char const* func,
+                               apilog_callsite const* cs,
+                               lua_State* L,
+                               char const* what,
+                               lua_Debug* ar )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getinfo( L, what, ar );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_getinfo
+#define lua_getinfo( L, what, ar ) \
+    apilog_getinfo( apilog_func, APILOG_CALLSITE( "lua_getinfo" ), (L), (what), (ar) )
+#endif
+
+
+#if APILOG_WANT( DEBUG ) && !defined( APILOG_NO_lua_getlocal )
+APILOG_API char const* apilog_getlocal( char const* func,
+                                        apilog_callsite const* cs,
+                                        lua_State* L,
+#if LUA_VERSION_NUM >= 503
+                                        lua_Debug const* ar,
+#else
+                                        lua_Debug* ar,
+#endif
+                                        int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getlocal( L, ar, n );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_getlocal
+#define lua_getlocal( L, ar, n ) \
+    apilog_getlocal( apilog_func, APILOG_CALLSITE( "lua_getlocal" ), (L), (ar), (n) )
+#endif
+
+
+#if APILOG_WANT( DEBUG ) && !defined( APILOG_NO_lua_getupvalue )
+APILOG_API char const* apilog_getupvalue( char const* func,
+                                          apilog_callsite const* cs,
+                                          lua_State* L,
+                                          int findex,
+                                          int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_getupvalue( L, findex, n );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_getupvalue
+#define lua_getupvalue( L, findex, n ) \
+    apilog_getupvalue( apilog_func, APILOG_CALLSITE( "lua_getupvalue" ), (L), (findex), (n) )
+#endif
+
+
+#if APILOG_WANT( DEBUG ) && !defined( APILOG_NO_lua_setlocal )
+APILOG_API char const* apilog_setlocal( char const* func,
+                                        apilog_callsite const* cs,
+                                        lua_State* L,
+#if LUA_VERSION_NUM >= 503
+                                        lua_Debug const* ar,
+#else
+                                        lua_Debug* ar,
+#endif
+                                        int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_setlocal( L, ar, n );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_setlocal
+#define lua_setlocal( L, ar, n ) \
+    apilog_setlocal( apilog_func, APILOG_CALLSITE( "lua_setlocal" ), (L), (ar), (n) )
+#endif
+
+
+#if APILOG_WANT( DEBUG ) && !defined( APILOG_NO_lua_setupvalue )
+APILOG_API char const* apilog_setupvalue( char const* func,
+                                          apilog_callsite const* cs,
+                                          lua_State* L,
+                                          int findex,
+                                          int n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = lua_setupvalue( L, findex, n );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef lua_setupvalue
+#define lua_setupvalue( L, findex, n ) \
+    apilog_setupvalue( apilog_func, APILOG_CALLSITE( "lua_setupvalue" ), (L), (findex), (n) )
+#endif
+
+
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_addlstring )
+APILOG_API void apilogL_addlstring( char const* func,
+                                    apilog_callsite const* cs,
+                                    luaL_Buffer* B,
+                                    char const* s,
+                                    size_t l )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* L = B->L;
+    unsigned long cap = APILOG_BUFCAP( B );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_addlstring( B, s, l );
+    APILOG_BUF_OP( func, cs, B, cap, l );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_addlstring
+#define luaL_addlstring( B, s, l ) \
+    apilogL_addlstring( apilog_func, APILOG_CALLSITE( "luaL_addlstring" ), (B), (s), (l) )
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_addstring )
+APILOG_API void apilogL_addstring( char const* func,
+                                   apilog_callsite const* cs,
+                                   luaL_Buffer* B,
+                                   char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* L = B->L;
+    unsigned long cap = APILOG_BUFCAP( B );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_addstring( B, s );
+    APILOG_BUF_OP( func, cs, B, cap, strlen( s ) );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_addstring
+#define luaL_addstring( B, s ) \
+    apilogL_addstring( apilog_func, APILOG_CALLSITE( "luaL_addstring" ), (B), (s) )
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_addvalue )
+APILOG_API void apilogL_addvalue( char const* func,
+                                  apilog_callsite const* cs,
+                                  luaL_Buffer* B )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* L = B->L;
+    unsigned long cap = APILOG_BUFCAP( B );
+    size_t n = APILOG_BUF_TOPLEN( L );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_addvalue( B );
+    APILOG_BUF_OP( func, cs, B, cap, n );
+    apilog_end( &frame, L, func, cs );
 }
-#undef lua_settable
-#define lua_settable( L, index ) \
-    apilog_settable( apilog_func, __FILE__, __LINE__, (L), (index) )
+#endif
+#undef luaL_addvalue
+#define luaL_addvalue( B ) \
+    apilogL_addvalue( apilog_func, APILOG_CALLSITE( "luaL_addvalue" ), (B) )
+#endif
 
 
-APILOG_API void apilog_settop( char const* func,
-                               char const* filename,
-                               int lineno,
-                               lua_State* L,
-                               int index ) {
-    lua_settop( L, index );
-    apilog_print( L, func, filename, lineno, "lua_settop" );
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_buffinit )
+APILOG_API void apilogL_buffinit( char const* func,
+                                  apilog_callsite const* cs,
+                                  lua_State* L,
+                                  luaL_Buffer* B )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_buffinit( L, B );
+    APILOG_BUF_INIT( func, cs, B );
+    apilog_end( &frame, L, func, cs );
 }
-#undef lua_settop
-#define lua_settop( L, index ) \
-    apilog_settop( apilog_func, __FILE__, __LINE__, (L), (index) )
+#endif
+#undef luaL_buffinit
+#define luaL_buffinit( L, B ) \
+    apilogL_buffinit( apilog_func, APILOG_CALLSITE( "luaL_buffinit" ), (L), (B) )
+#endif
 
 
-#if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
-APILOG_API void apilog_setuservalue( char const* func,
-                                     char const* filename,
-                                     int lineno,
-                                     lua_State* L,
-                                     int index ) {
-    lua_setuservalue( L, index );
-    apilog_print( L, func, filename, lineno, "lua_setuservalue" );
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_buffinitsize )
+#if LUA_VERSION_NUM >= 502
+APILOG_API char* apilogL_buffinitsize( char const* func,
+                                       apilog_callsite const* cs,
+                                       lua_State* L,
+                                       luaL_Buffer* B,
+                                       size_t sz )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_buffinitsize( L, B, sz );
+    APILOG_BUF_INIT( func, cs, B );
+    apilog_end( &frame, L, func, cs );
+    return result;
 }
-#undef lua_setuservalue
-#define lua_setuservalue( L, index ) \
-    apilog_setuservalue( apilog_func, __FILE__, __LINE__, (L), (index) )
+#endif
+#undef luaL_buffinitsize
+#define luaL_buffinitsize( L, B, sz ) \
+    apilogL_buffinitsize( apilog_func, APILOG_CALLSITE( "luaL_buffinitsize" ), (L), (B), (sz) )
+#endif
 #endif
 
 
-#if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
-APILOG_API size_t apilog_stringtonumber( char const* func,
-                                         char const* filename,
-                                         int lineno,
-                                         lua_State* L,
-                                         char const* s ) {
-    size_t result = lua_stringtonumber( L, s );
-    apilog_print( L, func, filename, lineno, "lua_stringtonumber" );
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_luaL_callmeta )
+APILOG_API int apilogL_callmeta( char const* func,
+                                 apilog_callsite const* cs,
+                                 lua_State* L,
+                                 int obj,
+                                 char const* e )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_callmeta( L, obj, e );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef lua_stringtonumber
-#define lua_stringtonumber( L, s ) \
-    apilog_stringtonumber( apilog_func, __FILE__, __LINE__, (L), (s) )
+#endif
+#undef luaL_callmeta
+#define luaL_callmeta( L, obj, e ) \
+    apilogL_callmeta( apilog_func, APILOG_CALLSITE( "luaL_callmeta" ), (L), (obj), (e) )
 #endif
 
 
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checkany )
+APILOG_API void apilogL_checkany( char const* func,
+                                  apilog_callsite const* cs,
+                                  lua_State* L,
+                                  int arg )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_checkany( L, arg );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_checkany
+#define luaL_checkany( L, arg ) \
+    apilogL_checkany( apilog_func, APILOG_CALLSITE( "luaL_checkany" ), (L), (arg) )
+#endif
 
 
-APILOG_API int apilog_getinfo( char const* func,
-                               char const* filename,
-                               int lineno,
-                               lua_State* L,
-                               char const* what,
-                               lua_Debug* ar ) {
-    int result = lua_getinfo( L, what, ar );
-    apilog_print( L, func, filename, lineno, "lua_getinfo" );
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checkinteger )
+APILOG_API lua_Integer apilogL_checkinteger( char const* func,
+                                             apilog_callsite const* cs,
+                                             lua_State* L,
+                                             int arg )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_Integer result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_checkinteger( L, arg );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef lua_getinfo
-#define lua_getinfo( L, what, ar ) \
-    apilog_getinfo( apilog_func, __FILE__, __LINE__, (L), (what), (ar) )
+#endif
+#undef luaL_checkinteger
+#define luaL_checkinteger( L, arg ) \
+    apilogL_checkinteger( apilog_func, APILOG_CALLSITE( "luaL_checkinteger" ), (L), (arg) )
+#endif
 
 
-APILOG_API char const* apilog_getlocal( char const* func,
-                                        char const* filename,
-                                        int lineno,
-                                        lua_State* L,
-#if LUA_VERSION_NUM >= 503
-                                        lua_Debug const* ar,
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checklstring )
+APILOG_API char const* apilogL_checklstring( char const* func,
+                                             apilog_callsite const* cs,
+                                             lua_State* L,
+                                             int arg,
+                                             size_t* l )
+#if defined( APILOG_DECLARE_ONLY )
+;
 #else
-                                        lua_Debug* ar,
-#endif
-                                        int n ) {
-    char const* result = lua_getlocal( L, ar, n );
-    apilog_print( L, func, filename, lineno, "lua_getlocal" );
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_checklstring( L, arg, l );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef lua_getlocal
-#define lua_getlocal( L, ar, n ) \
-    apilog_getlocal( apilog_func, __FILE__, __LINE__, (L), (ar), (n) )
+#endif
+#undef luaL_checklstring
+#define luaL_checklstring( L, arg, l ) \
+    apilogL_checklstring( apilog_func, APILOG_CALLSITE( "luaL_checklstring" ), (L), (arg), (l) )
+#endif
 
 
-APILOG_API char const* apilog_getupvalue( char const* func,
-                                          char const* filename,
-                                          int lineno,
-                                          lua_State* L,
-                                          int findex,
-                                          int n ) {
-    char const* result = lua_getupvalue( L, findex, n );
-    apilog_print( L, func, filename, lineno, "lua_getupvalue" );
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checknumber )
+APILOG_API lua_Number apilogL_checknumber( char const* func,
+                                           apilog_callsite const* cs,
+                                           lua_State* L,
+                                           int arg )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_Number result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_checknumber( L, arg );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef lua_getupvalue
-#define lua_getupvalue( L, findex, n ) \
-    apilog_getupvalue( apilog_func, __FILE__, __LINE__, (L), (findex), (n) )
+#endif
+#undef luaL_checknumber
+#define luaL_checknumber( L, arg ) \
+    apilogL_checknumber( apilog_func, APILOG_CALLSITE( "luaL_checknumber" ), (L), (arg) )
+#endif
 
 
-APILOG_API char const* apilog_setlocal( char const* func,
-                                        char const* filename,
-                                        int lineno,
-                                        lua_State* L,
-#if LUA_VERSION_NUM >= 503
-                                        lua_Debug const* ar,
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checkoption )
+APILOG_API int apilogL_checkoption( char const* func,
+                                    apilog_callsite const* cs,
+                                    lua_State* L,
+                                    int arg,
+                                    char const* def,
+                                    char const* const lst[] )
+#if defined( APILOG_DECLARE_ONLY )
+;
 #else
-                                        lua_Debug* ar,
-#endif
-                                        int n ) {
-    char const* result = lua_setlocal( L, ar, n );
-    apilog_print( L, func, filename, lineno, "lua_setlocal" );
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_checkoption( L, arg, def, lst );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef lua_setlocal
-#define lua_setlocal( L, ar, n ) \
-    apilog_setlocal( apilog_func, __FILE__, __LINE__, (L), (ar), (n) )
+#endif
+#undef luaL_checkoption
+#define luaL_checkoption( L, arg, def, lst ) \
+    apilogL_checkoption( apilog_func, APILOG_CALLSITE( "luaL_checkoption" ), (L), (arg), (def), (lst) )
+#endif
 
 
-APILOG_API char const* apilog_setupvalue( char const* func,
-                                          char const* filename,
-                                          int lineno,
-                                          lua_State* L,
-                                          int findex,
-                                          int n ) {
-    char const* result = lua_setupvalue( L, findex, n );
-    apilog_print( L, func, filename, lineno, "lua_setupvalue" );
-    return result;
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checkstack )
+APILOG_API void apilogL_checkstack( char const* func,
+                                    apilog_callsite const* cs,
+                                    lua_State* L,
+                                    int sz,
+                                    char const* msg )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_checkstack( L, sz, msg );
+    apilog_end( &frame, L, func, cs );
 }
-#undef lua_setupvalue
-#define lua_setupvalue( L, findex, n ) \
-    apilog_setupvalue( apilog_func, __FILE__, __LINE__, (L), (findex), (n) )
+#endif
+#undef luaL_checkstack
+#define luaL_checkstack( L, sz, msg ) \
+    apilogL_checkstack( apilog_func, APILOG_CALLSITE( "luaL_checkstack" ), (L), (sz), (msg) )
+#endif
 
 
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checktype )
+APILOG_API void apilogL_checktype( char const* func,
+                                   apilog_callsite const* cs,
+                                   lua_State* L,
+                                   int arg,
+                                   int t )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_checktype( L, arg, t );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_checktype
+#define luaL_checktype( L, arg, t ) \
+    apilogL_checktype( apilog_func, APILOG_CALLSITE( "luaL_checktype" ), (L), (arg), (t) )
+#endif
 
 
-APILOG_API int apilogL_callmeta( char const* func,
-                                 char const* filename,
-                                 int lineno,
-                                 lua_State* L,
-                                 int obj,
-                                 char const* e ) {
-    int result = luaL_callmeta( L, obj, e );
-    apilog_print( L, func, filename, lineno, "luaL_callmeta" );
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_checkudata )
+APILOG_API void* apilogL_checkudata( char const* func,
+                                     apilog_callsite const* cs,
+                                     lua_State* L,
+                                     int arg,
+                                     char const* tname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    void* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_checkudata( L, arg, tname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
-#undef luaL_callmeta
-#define luaL_callmeta( L, obj, e ) \
-    apilogL_callmeta( apilog_func, __FILE__, __LINE__, (L), (obj), (e) )
+#endif
+#undef luaL_checkudata
+#define luaL_checkudata( L, arg, tname ) \
+    apilogL_checkudata( apilog_func, APILOG_CALLSITE( "luaL_checkudata" ), (L), (arg), (tname) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_luaL_dofile )
 APILOG_API int apilogL_dofile( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               char const* fname ) {
-    int result = luaL_dofile( L, fname );
-    apilog_print( L, func, filename, lineno, "luaL_dofile" );
+                               char const* fname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_dofile( L, fname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_dofile
 #define luaL_dofile( L, fname ) \
-    apilogL_dofile( apilog_func, __FILE__, __LINE__, (L), (fname) )
+    apilogL_dofile( apilog_func, APILOG_CALLSITE( "luaL_dofile" ), (L), (fname) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_luaL_dostring )
 APILOG_API int apilogL_dostring( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
-                                 char const* s ) {
-    int result = luaL_dostring( L, s );
-    apilog_print( L, func, filename, lineno, "luaL_dostring" );
+                                 char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_dostring( L, s );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_dostring
 #define luaL_dostring( L, s ) \
-    apilogL_dostring( apilog_func, __FILE__, __LINE__, (L), (s) )
+    apilogL_dostring( apilog_func, APILOG_CALLSITE( "luaL_dostring" ), (L), (s) )
+#endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_execresult )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_execresult( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
-                                   int stat ) {
-    int result = luaL_execresult( L, stat );
-    apilog_print( L, func, filename, lineno, "luaL_execresult" );
+                                   int stat )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_execresult( L, stat );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_execresult
 #define luaL_execresult( L, stat ) \
-    apilogL_execresult( apilog_func, __FILE__, __LINE__, (L), (stat) )
+    apilogL_execresult( apilog_func, APILOG_CALLSITE( "luaL_execresult" ), (L), (stat) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_fileresult )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_fileresult( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
                                    int stat,
-                                   char const* fname ) {
-    int result = luaL_fileresult( L, stat, fname );
-    apilog_print( L, func, filename, lineno, "luaL_fileresult" );
+                                   char const* fname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_fileresult( L, stat, fname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_fileresult
 #define luaL_fileresult( L, stat, fname ) \
-    apilogL_fileresult( apilog_func, __FILE__, __LINE__, (L), (stat), (fname) )
+    apilogL_fileresult( apilog_func, APILOG_CALLSITE( "luaL_fileresult" ), (L), (stat), (fname) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_getmetafield )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_getmetafield( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
                                      int obj,
-                                     char const* e ) {
-    int result = luaL_getmetafield( L, obj, e );
-    apilog_print( L, func, filename, lineno, "luaL_getmetafield" );
+                                     char const* e )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_getmetafield( L, obj, e );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_getmetafield
 #define luaL_getmetafield( L, obj, e ) \
-    apilogL_getmetafield( apilog_func, __FILE__, __LINE__, (L), (obj), (e) )
+    apilogL_getmetafield( apilog_func, APILOG_CALLSITE( "luaL_getmetafield" ), (L), (obj), (e) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_getmetatable )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 #if LUA_VERSION_NUM >= 503 || defined( COMPAT53_API )
 APILOG_API int apilogL_getmetatable( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     char const* tname ) {
-    int result = luaL_getmetatable( L, tname );
-    apilog_print( L, func, filename, lineno, "luaL_getmetatable" );
+                                     char const* tname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_getmetatable( L, tname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #else
 APILOG_API void apilogL_getmetatable( char const* func,
-                                      char const* filename,
-                                      int lineno,
+                                      apilog_callsite const* cs,
                                       lua_State* L,
-                                      char const* tname ) {
+                                      char const* tname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_getmetatable( L, tname );
-    apilog_print( L, func, filename, lineno, "luaL_getmetatable" );
+    apilog_end( &frame, L, func, cs );
 }
 #endif
+#endif
 #undef luaL_getmetatable
 #define luaL_getmetatable( L, tname ) \
-    apilogL_getmetatable( apilog_func, __FILE__, __LINE__, (L), (tname) )
+    apilogL_getmetatable( apilog_func, APILOG_CALLSITE( "luaL_getmetatable" ), (L), (tname) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_getsubtable )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_getsubtable( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
                                     int idx,
-                                    char const* fname ) {
-    int result = luaL_getsubtable( L, idx, fname );
-    apilog_print( L, func, filename, lineno, "luaL_getsubtable" );
+                                    char const* fname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_getsubtable( L, idx, fname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_getsubtable
 #define luaL_getsubtable( L, fname ) \
-    apilogL_getsubtable( apilog_func, __FILE__, __LINE__, (L), (fname) )
+    apilogL_getsubtable( apilog_func, APILOG_CALLSITE( "luaL_getsubtable" ), (L), (fname) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_gsub )
 #if LUA_VERSION_NUM >= 502
 APILOG_API char const* apilogL_gsub( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
                                      char const* s,
                                      char const* p,
-                                     char const* r ) {
-    char const* result = luaL_gsub( L, s, p, r );
-    apilog_print( L, func, filename, lineno, "luaL_gsub" );
+                                     char const* r )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_gsub( L, s, p, r );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_gsub
 #define luaL_gsub( L, s, p, r ) \
-    apilogL_gsub( apilog_func, __FILE__, __LINE__, (L), (s), (p), (r) )
+    apilogL_gsub( apilog_func, APILOG_CALLSITE( "luaL_gsub" ), (L), (s), (p), (r) )
+#endif
 #endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_luaL_loadbuffer )
 APILOG_API int apilogL_loadbuffer( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
                                    char const* buf,
                                    size_t sz,
-                                   char const* name ) {
-    int result = luaL_loadbuffer( L, buf, sz, name );
-    apilog_print( L, func, filename, lineno, "luaL_loadbuffer" );
+                                   char const* name )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_loadbuffer( L, buf, sz, name );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_loadbuffer
 #define luaL_loadbuffer( L, buf, sz, name ) \
-    apilogL_loadbuffer( apilog_func, __FILE__, __LINE__, (L), (buf), (sz), (name) )
+    apilogL_loadbuffer( apilog_func, APILOG_CALLSITE( "luaL_loadbuffer" ), (L), (buf), (sz), (name) )
+#endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_luaL_loadbufferx )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_loadbufferx( char const* func,
-                                    char const* filename,
-                                    int lineno,
+                                    apilog_callsite const* cs,
                                     lua_State* L,
                                     char const* buf,
                                     size_t sz,
                                     char const* name,
-                                    char const* mode ) {
-    int result = luaL_loadbufferx( L, buf, sz, name, mode );
-    apilog_print( L, func, filename, lineno, "luaL_loadbufferx" );
+                                    char const* mode )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_loadbufferx( L, buf, sz, name, mode );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_loadbufferx
 #define luaL_loadbufferx( L, buf, sz, name, mode ) \
-    apilogL_loadbufferx( apilog_func, __FILE__, __LINE__, (L), (buf), (sz), (name), (mode) )
+    apilogL_loadbufferx( apilog_func, APILOG_CALLSITE( "luaL_loadbufferx" ), (L), (buf), (sz), (name), (mode) )
+#endif
 #endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_luaL_loadfile )
 APILOG_API int apilogL_loadfile( char const* func,
-                                 char const* filename,
-                                 int lineno,
+                                 apilog_callsite const* cs,
                                  lua_State* L,
-                                 char const* fname ) {
-    int result = luaL_loadfile( L, fname );
-    apilog_print( L, func, filename, lineno, "luaL_loadfile" );
+                                 char const* fname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_loadfile( L, fname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_loadfile
 #define luaL_loadfile( L, fname ) \
-    apilogL_loadfile( apilog_func, __FILE__, __LINE__, (L), (fname) )
+    apilogL_loadfile( apilog_func, APILOG_CALLSITE( "luaL_loadfile" ), (L), (fname) )
+#endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_luaL_loadfilex )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API int apilogL_loadfilex( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
                                   char const* fname,
-                                  char const* mode ) {
-    int result = luaL_loadfilex( L, fname, mode );
-    apilog_print( L, func, filename, lineno, "luaL_loadfilex" );
+                                  char const* mode )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_loadfilex( L, fname, mode );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_loadfilex
 #define luaL_loadfilex( L, name, mode ) \
-    apilogL_loadfilex( apilog_func, __FILE__, __LINE__, (L), (name), (mode) )
+    apilogL_loadfilex( apilog_func, APILOG_CALLSITE( "luaL_loadfilex" ), (L), (name), (mode) )
+#endif
 #endif
 
 
+#if APILOG_WANT( LOAD ) && !defined( APILOG_NO_luaL_loadstring )
 APILOG_API int apilogL_loadstring( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
-                                   char const* s ) {
-    int result = luaL_loadstring( L, s );
-    apilog_print( L, func, filename, lineno, "luaL_loadstring" );
+                                   char const* s )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_loadstring( L, s );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_loadstring
 #define luaL_loadstring( L, s ) \
-    apilogL_loadstring( apilog_func, __FILE__, __LINE__, (L), (s) )
+    apilogL_loadstring( apilog_func, APILOG_CALLSITE( "luaL_loadstring" ), (L), (s) )
+#endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_newlib )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilogL_newlib( char const* func,
-                                char const* filename,
-                                int lineno,
+                                apilog_callsite const* cs,
                                 lua_State* L,
                                 luaL_Reg const* r,
-                                size_t n ) {
+                                size_t n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     (lua_createtable)( L, 0, n );
     (luaL_setfuncs)( L, r, 0 );
-    apilog_print( L, func, filename, lineno, "luaL_newlib" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_newlib
 #define luaL_newlib( L, r ) \
-    apilogL_newlib( apilog_func, __FILE__, __LINE__, (L), (r), (sizeof( (r) )/sizeof( *(r) ))-1 )
+    apilogL_newlib( apilog_func, APILOG_CALLSITE( "luaL_newlib" ), (L), (r), (sizeof( (r) )/sizeof( *(r) ))-1 )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_newlibtable )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilogL_newlibtable( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     size_t n ) {
+                                     size_t n )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     (lua_createtable)( L, 0, n );
-    apilog_print( L, func, filename, lineno, "luaL_newlibtable" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_newlibtable
 #define luaL_newlibtable( L, r ) \
-    apilogL_newlibtable( apilog_func, __FILE__, __LINE__, (L), (sizeof( (r) )/sizeof( *(r) ))-1 )
+    apilogL_newlibtable( apilog_func, APILOG_CALLSITE( "luaL_newlibtable" ), (L), (sizeof( (r) )/sizeof( *(r) ))-1 )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_newmetatable )
 APILOG_API int apilogL_newmetatable( char const* func,
-                                     char const* filename,
-                                     int lineno,
+                                     apilog_callsite const* cs,
                                      lua_State* L,
-                                     char const* tname ) {
-    int result = luaL_newmetatable( L, tname );
-    apilog_print( L, func, filename, lineno, "luaL_newmetatable" );
+                                     char const* tname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_newmetatable( L, tname );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_newmetatable
 #define luaL_newmetatable( L, tname ) \
-    apilogL_newmetatable( apilog_func, __FILE__, __LINE__, (L), (tname) )
+    apilogL_newmetatable( apilog_func, APILOG_CALLSITE( "luaL_newmetatable" ), (L), (tname) )
+#endif
+
+
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_optinteger )
+APILOG_API lua_Integer apilogL_optinteger( char const* func,
+                                           apilog_callsite const* cs,
+                                           lua_State* L,
+                                           int arg,
+                                           lua_Integer def )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_Integer result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_optinteger( L, arg, def );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_optinteger
+#define luaL_optinteger( L, arg, def ) \
+    apilogL_optinteger( apilog_func, APILOG_CALLSITE( "luaL_optinteger" ), (L), (arg), (def) )
+#endif
+
+
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_optlstring )
+APILOG_API char const* apilogL_optlstring( char const* func,
+                                           apilog_callsite const* cs,
+                                           lua_State* L,
+                                           int arg,
+                                           char const* def,
+                                           size_t* l )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_optlstring( L, arg, def, l );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_optlstring
+#define luaL_optlstring( L, arg, def, l ) \
+    apilogL_optlstring( apilog_func, APILOG_CALLSITE( "luaL_optlstring" ), (L), (arg), (def), (l) )
+#endif
+
+
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_optnumber )
+APILOG_API lua_Number apilogL_optnumber( char const* func,
+                                         apilog_callsite const* cs,
+                                         lua_State* L,
+                                         int arg,
+                                         lua_Number def )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_Number result = 0;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_optnumber( L, arg, def );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_optnumber
+#define luaL_optnumber( L, arg, def ) \
+    apilogL_optnumber( apilog_func, APILOG_CALLSITE( "luaL_optnumber" ), (L), (arg), (def) )
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_prepbuffsize )
+#if LUA_VERSION_NUM >= 502
+APILOG_API char* apilogL_prepbuffsize( char const* func,
+                                       apilog_callsite const* cs,
+                                       luaL_Buffer* B,
+                                       size_t sz )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char* result = NULL;
+    lua_State* L = B->L;
+    unsigned long cap = APILOG_BUFCAP( B );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_prepbuffsize( B, sz );
+    APILOG_BUF_OP( func, cs, B, cap, 0 );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_prepbuffsize
+#define luaL_prepbuffsize( B, sz ) \
+    apilogL_prepbuffsize( apilog_func, APILOG_CALLSITE( "luaL_prepbuffsize" ), (B), (sz) )
+#else
+APILOG_API char* apilogL_prepbuffer( char const* func,
+                                     apilog_callsite const* cs,
+                                     luaL_Buffer* B )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char* result = NULL;
+    lua_State* L = B->L;
+    unsigned long cap = APILOG_BUFCAP( B );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_prepbuffer( B );
+    APILOG_BUF_OP( func, cs, B, cap, 0 );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_prepbuffer
+#define luaL_prepbuffer( B ) \
+    apilogL_prepbuffer( apilog_func, APILOG_CALLSITE( "luaL_prepbuffer" ), (B) )
+#endif
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_pushresult )
+APILOG_API void apilogL_pushresult( char const* func,
+                                    apilog_callsite const* cs,
+                                    luaL_Buffer* B )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* L = B->L;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_pushresult( B );
+    APILOG_BUF_DONE( func, cs, B );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_pushresult
+#define luaL_pushresult( B ) \
+    apilogL_pushresult( apilog_func, APILOG_CALLSITE( "luaL_pushresult" ), (B) )
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_pushresultsize )
+#if LUA_VERSION_NUM >= 502
+APILOG_API void apilogL_pushresultsize( char const* func,
+                                        apilog_callsite const* cs,
+                                        luaL_Buffer* B,
+                                        size_t sz )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    lua_State* L = B->L;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_pushresultsize( B, sz );
+    APILOG_BUF_DONE( func, cs, B );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_pushresultsize
+#define luaL_pushresultsize( B, sz ) \
+    apilogL_pushresultsize( apilog_func, APILOG_CALLSITE( "luaL_pushresultsize" ), (B), (sz) )
+#endif
+#endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_ref )
 APILOG_API int apilogL_ref( char const* func,
-                            char const* filename,
-                            int lineno,
+                            apilog_callsite const* cs,
                             lua_State* L,
-                            int t ) {
-    int result = luaL_ref( L, t );
-    apilog_print( L, func, filename, lineno, "luaL_ref" );
+                            int t )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    int result = 0;
+    void const* p = APILOG_REF_TABLE( L, t );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_ref( L, t );
+    APILOG_REF_NEW( func, cs, p, t, result );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_ref
 #define luaL_ref( L, t ) \
-    apilogL_ref( apilog_func, __FILE__, __LINE__, (L), (t) )
+    apilogL_ref( apilog_func, APILOG_CALLSITE( "luaL_ref" ), (L), (t) )
+#endif
 
 
+#if APILOG_WANT( CALL ) && !defined( APILOG_NO_luaL_requiref )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilogL_requiref( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
                                   char const* modname,
                                   lua_CFunction openf,
-                                  int glb ) {
+                                  int glb )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_requiref( L, modname, openf, glb );
-    apilog_print( L, func, filename, lineno, "luaL_requiref" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_requiref
 #define luaL_requiref( L, modname, openf, glb ) \
-    apilogL_requiref( apilog_func, __FILE__, __LINE__, (L), (modname), (openf), (glb) )
+    apilogL_requiref( apilog_func, APILOG_CALLSITE( "luaL_requiref" ), (L), (modname), (openf), (glb) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_register )
 #if LUA_VERSION_NUM == 501
 APILOG_API void apilogL_register( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
                                   char const* libname,
-                                  luaL_Reg const* r ) {
+                                  luaL_Reg const* r )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_register( L, libname, r );
-    apilog_print( L, func, filename, lineno, "luaL_register" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_register
 #define luaL_register( L, libname, r ) \
-    apilogL_register( apilog_func, __FILE__, __LINE__, (L), (libname), (r) )
+    apilogL_register( apilog_func, APILOG_CALLSITE( "luaL_register" ), (L), (libname), (r) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_setfuncs )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilogL_setfuncs( char const* func,
-                                  char const* filename,
-                                  int lineno,
+                                  apilog_callsite const* cs,
                                   lua_State* L,
                                   luaL_Reg const* r,
-                                  int nup ) {
+                                  int nup )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_setfuncs( L, r, nup );
-    apilog_print( L, func, filename, lineno, "luaL_setfuncs" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_setfuncs
 #define luaL_setfuncs( L, r, nup ) \
-    apilogL_setfuncs( apilog_func, __FILE__, __LINE__, (L), (r), (nup) )
+    apilogL_setfuncs( apilog_func, APILOG_CALLSITE( "luaL_setfuncs" ), (L), (r), (nup) )
+#endif
+#endif
+
+
+#if APILOG_WANT( CHECK ) && !defined( APILOG_NO_luaL_testudata )
+#if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
+APILOG_API void* apilogL_testudata( char const* func,
+                                    apilog_callsite const* cs,
+                                    lua_State* L,
+                                    int arg,
+                                    char const* tname )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    void* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_testudata( L, arg, tname );
+    apilog_end( &frame, L, func, cs );
+    return result;
+}
+#endif
+#undef luaL_testudata
+#define luaL_testudata( L, arg, tname ) \
+    apilogL_testudata( apilog_func, APILOG_CALLSITE( "luaL_testudata" ), (L), (arg), (tname) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_tolstring )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API char const* apilogL_tolstring( char const* func,
-                                          char const* filename,
-                                          int lineno,
+                                          apilog_callsite const* cs,
                                           lua_State* L,
                                           int idx,
-                                          size_t* sz ) {
-    char const* result = luaL_tolstring( L, idx, sz );
-    apilog_print( L, func, filename, lineno, "luaL_tolstring" );
+                                          size_t* sz )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    char const* result = NULL;
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    result = luaL_tolstring( L, idx, sz );
+    apilog_end( &frame, L, func, cs );
     return result;
 }
+#endif
 #undef luaL_tolstring
 #define luaL_tolstring( L, idx, sz ) \
-    apilogL_tolstring( apilog_func, __FILE__, __LINE__, (L), (idx), (sz) )
+    apilogL_tolstring( apilog_func, APILOG_CALLSITE( "luaL_tolstring" ), (L), (idx), (sz) )
+#endif
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_traceback )
 #if LUA_VERSION_NUM >= 502 || defined( COMPAT53_API )
 APILOG_API void apilogL_traceback( char const* func,
-                                   char const* filename,
-                                   int lineno,
+                                   apilog_callsite const* cs,
                                    lua_State* L,
                                    lua_State* L1,
                                    char const* msg,
-                                   int level ) {
+                                   int level )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_traceback( L, L1, msg, level );
-    apilog_print( L, func, filename, lineno, "luaL_traceback" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_traceback
 #define luaL_traceback( L, L1, msg, level ) \
-    apilogL_traceback( apilog_func, __FILE__, __LINE__, (L), (L1), (msg), (level) )
+    apilogL_traceback( apilog_func, APILOG_CALLSITE( "luaL_traceback" ), (L), (L1), (msg), (level) )
+#endif
+#endif
+
+
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_unref )
+APILOG_API void apilogL_unref( char const* func,
+                               apilog_callsite const* cs,
+                               lua_State* L,
+                               int t,
+                               int ref )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    void const* p = APILOG_REF_TABLE( L, t );
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
+    luaL_unref( L, t, ref );
+    APILOG_REF_FREE( p, ref );
+    apilog_end( &frame, L, func, cs );
+}
+#endif
+#undef luaL_unref
+#define luaL_unref( L, t, ref ) \
+    apilogL_unref( apilog_func, APILOG_CALLSITE( "luaL_unref" ), (L), (t), (ref) )
 #endif
 
 
+#if APILOG_WANT( AUX ) && !defined( APILOG_NO_luaL_where )
 APILOG_API void apilogL_where( char const* func,
-                               char const* filename,
-                               int lineno,
+                               apilog_callsite const* cs,
                                lua_State* L,
-                               int lvl ) {
+                               int lvl )
+#if defined( APILOG_DECLARE_ONLY )
+;
+#else
+{
+    apilog_frame frame;
+    apilog_begin( &frame, func, cs, L );
     luaL_where( L, lvl );
-    apilog_print( L, func, filename, lineno, "luaL_where" );
+    apilog_end( &frame, L, func, cs );
 }
+#endif
 #undef luaL_where
 #define luaL_where( L, lvl ) \
-    apilogL_where( apilog_func, __FILE__, __LINE__, (L), (lvl) )
+    apilogL_where( apilog_func, APILOG_CALLSITE( "luaL_where" ), (L), (lvl) )
+#endif
+
+
+/* The extra space of new main states must be cleared before apilog
+ * looks at it. */
+#if defined( APILOG_EXTRASPACE ) && LUA_VERSION_NUM >= 503 && \
+    (defined( APILOG_DIFF ) || defined( APILOG_RECORDER ))
+#undef lua_newstate
+#define lua_newstate( f, ud ) apilog_xspace_init( lua_newstate( (f), (ud) ) )
+#undef luaL_newstate
+#define luaL_newstate() apilog_xspace_init( luaL_newstate() )
+#endif
 
 
 #undef apilog_func
+#if defined( APILOG_DECLARE_ONLY )
+APILOG_API char const* apilog_func;
+#else
 APILOG_API char const* apilog_func = NULL;
+#endif
+
+
+#endif /* APILOG_DECODER */
 
 
 /* TODO: check compatibility with compat53 */
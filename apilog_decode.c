@@ -0,0 +1,30 @@
+/* Converts a binary apilog trace (see APILOG_BINARY in apilog.h) to
+ * the usual text format. Doesn't need the Lua headers:
+ *
+ *     cc -o apilog_decode apilog_decode.c
+ *     ./apilog_decode apilog.bin
+ */
+#define APILOG_DECODER
+#include "apilog.h"
+
+
+int main( int argc, char* argv[] ) {
+    FILE* in = stdin;
+    int status = 0;
+    if( argc > 2 ) {
+        fprintf( stderr, "usage: %s [tracefile]\n", argv[ 0 ] );
+        return EXIT_FAILURE;
+    }
+    if( argc == 2 && (in = fopen( argv[ 1 ], "rb" )) == NULL ) {
+        perror( argv[ 1 ] );
+        return EXIT_FAILURE;
+    }
+    status = apilog_decode( in, stdout );
+    if( in != stdin )
+        fclose( in );
+    if( status != 0 ) {
+        fputs( "apilog_decode: malformed trace file\n", stderr );
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
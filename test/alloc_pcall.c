@@ -0,0 +1,63 @@
+/* Checks that allocations after an error raised in a wrapped
+ * `lua_call()` (and caught by `pcall()`) are not charged to that call.
+ *
+ *     cc -I.. -I/path/to/lua/include alloc_pcall.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_ALLOC
+#define APILOG_QUIET
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+#include "lualib.h"
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    lua_pushvalue( L, 1 );
+    lua_call( L, 0, 0 );
+    return 0;
+}
+
+
+static apilog_site const* find( char const* func, char const* api ) {
+    size_t i = 0;
+    for( i = 0; i < APILOG_SITE_BUCKETS; ++i ) {
+        apilog_site const* s = apilog_sitetab[ i ];
+        for( ; s != NULL; s = s->next )
+            if( strcmp( s->func, func ) == 0 && strcmp( s->api, api ) == 0 )
+                return s;
+    }
+    return NULL;
+}
+
+
+static char const code[] =
+    "for i = 1, 5 do pcall( f, function() error( 'x' ) end ) end\n"
+    "local t = {}\n"
+    "for i = 1, 20000 do t[ i ] = { i } end\n";
+
+
+int main( void ) {
+    lua_State* L = luaL_newstate();
+    apilog_site const* call = NULL;
+    if( L == NULL )
+        return 1;
+    luaL_openlibs( L );
+    lua_pushcfunction( L, f );
+    lua_setglobal( L, "f" );
+    if( luaL_loadstring( L, code ) != 0 || lua_pcall( L, 0, 0, 0 ) != 0 ) {
+        fprintf( stderr, "%s\n", lua_tostring( L, -1 ) );
+        return 1;
+    }
+    call = find( "f", "lua_call" );
+    /* the 20000 tables are allocated outside of wrapped API calls */
+    if( call == NULL || call->nallocs >= 20000 ||
+        apilog_othersite.nallocs < 20000 ) {
+        fprintf( stderr, "alloc_pcall: FAILED\n" );
+        return 1;
+    }
+    lua_close( L );
+    printf( "alloc_pcall: ok\n" );
+    return 0;
+}
@@ -0,0 +1,78 @@
+/* Checks that with APILOG_ASYNC_BLOCK and tiny ring buffers no log
+ * lines of several threads are dropped or torn.
+ *
+ *     cc -I.. -I/path/to/lua/include async_block.c -llua -lm -pthread
+ *     ./a.out
+ */
+#define APILOG_ASYNC
+#define APILOG_ASYNC_BLOCK
+#define APILOG_BUFFER_SIZE 1024
+#define APILOG_QUEUE_SIZE 4096
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#define LOGFILE "async_block.log"
+#define THREADS 4
+#define CALLS 2000
+
+
+static void* run( void* arg ) {
+    static char const* apilog_func = "run";
+    lua_State* L = luaL_newstate();
+    int i = 0;
+    (void)arg;
+    if( L == NULL )
+        return NULL;
+    for( i = 0; i < CALLS; ++i ) {
+        if( i % 10 == 0 )
+            lua_settop( L, 0 );
+        else
+            lua_pushinteger( L, i );
+    }
+    lua_close( L );
+    return NULL;
+}
+
+
+int main( void ) {
+    pthread_t threads[ THREADS ];
+    FILE* log = NULL;
+    char line[ 512 ];
+    char prefix[ 512 ];
+    size_t count = 0;
+    int failed = 0;
+    int i = 0;
+    sprintf( prefix, "run@%s:", __FILE__ );
+    if( freopen( LOGFILE, "w", stderr ) == NULL )
+        return 1;
+    for( i = 0; i < THREADS; ++i )
+        if( pthread_create( threads+i, NULL, run, NULL ) != 0 )
+            return 1;
+    for( i = 0; i < THREADS; ++i )
+        pthread_join( threads[ i ], NULL );
+    apilog_flush();
+    if( apilog_dropped() != 0 || (log = fopen( LOGFILE, "r" )) == NULL )
+        failed = 1;
+    while( !failed && fgets( line, sizeof( line ), log ) != NULL ) {
+        size_t len = strlen( line );
+        count++;
+        if( strncmp( line, "lua_settop in run@", 18 ) != 0 &&
+            strncmp( line, "lua_pushinteger in run@", 23 ) != 0 )
+            failed = 1;
+        if( strstr( line, prefix ) == NULL || len < 3 ||
+            strcmp( line+len-3, " ]\n" ) != 0 )
+            failed = 1;
+    }
+    if( log != NULL )
+        fclose( log );
+    remove( LOGFILE );
+    if( failed || count != (size_t)THREADS*CALLS ) {
+        printf( "async_block: FAILED\n" );
+        return 1;
+    }
+    printf( "async_block: ok\n" );
+    return 0;
+}
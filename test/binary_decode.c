@@ -0,0 +1,92 @@
+/* Checks that the binary trace decodes to the same lines as the text
+ * output, including stacks that span more than one snapshot chunk.
+ *
+ *     cc -I.. -I/path/to/lua/include binary_decode.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_BINARY
+#define APILOG_BINARY_FILE "binary_decode.bin"
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static int line0 = 0;
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    int i = 0;
+    line0 = __LINE__;
+    lua_settop( L, 0 );
+    lua_pushinteger( L, 1 );
+    lua_pushstring( L, "x" );
+    lua_newtable( L );
+    lua_pushnil( L );
+    lua_pushboolean( L, 1 );
+    lua_settop( L, 0 );
+    luaL_checkstack( L, 70, NULL );
+    for( i = 0; i < 70; ++i )
+        lua_pushnil( L );
+    return 0;
+}
+
+
+int main( void ) {
+    static char const* const expected[][ 2 ] = {
+        { "lua_settop", "[ ]" },
+        { "lua_pushinteger", "[ i ]" },
+        { "lua_pushstring", "[ i s ]" },
+        { "lua_newtable", "[ i s t ]" },
+        { "lua_pushnil", "[ i s t n ]" },
+        { "lua_pushboolean", "[ i s t n b ]" },
+        { "lua_settop", "[ ]" }
+    };
+    size_t const n = sizeof( expected ) / sizeof( *expected );
+    lua_State* L = luaL_newstate();
+    FILE* in = NULL;
+    FILE* out = NULL;
+    char line[ 512 ];
+    char want[ 512 ];
+    size_t i = 0;
+    int failed = 0;
+    if( L == NULL )
+        return 1;
+    remove( APILOG_BINARY_FILE );
+    lua_pushcfunction( L, f );
+    lua_call( L, 0, 0 );
+    lua_close( L );
+    apilog_flush();
+    if( (in = fopen( APILOG_BINARY_FILE, "rb" )) == NULL ||
+        (out = tmpfile()) == NULL || apilog_decode( in, out ) != 0 ) {
+        fprintf( stderr, "binary_decode: FAILED (decode)\n" );
+        return 1;
+    }
+    fclose( in );
+    remove( APILOG_BINARY_FILE );
+    rewind( out );
+    for( i = 0; fgets( line, sizeof( line ), out ) != NULL; ++i ) {
+        line[ strcspn( line, "\n" ) ] = '\0';
+        if( i < n ) {
+            sprintf( want, "%s in f@%s:%d:  %s", expected[ i ][ 0 ],
+                     __FILE__, line0+1+(int)i, expected[ i ][ 1 ] );
+            if( strcmp( line, want ) != 0 )
+                failed = 1;
+        }
+        /* the last line has 70 nils, i.e. two snapshot chunks */
+        if( i == n+69 ) {
+            sprintf( want, "lua_pushnil in f@%s:%d:  [", __FILE__,
+                     line0+10 );
+            if( strlen( line ) != strlen( want ) + 2*70 + 2 ||
+                strncmp( line, want, strlen( want ) ) != 0 ||
+                strcmp( line + strlen( line ) - 6, " n n ]" ) != 0 )
+                failed = 1;
+        }
+    }
+    fclose( out );
+    if( failed || i != n+70 ) {
+        fprintf( stderr, "binary_decode: FAILED\n" );
+        return 1;
+    }
+    printf( "binary_decode: ok\n" );
+    return 0;
+}
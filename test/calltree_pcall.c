@@ -0,0 +1,92 @@
+/* Checks that the call tree stays in step with the C stack when an
+ * error raised in a wrapped `lua_call()` is caught by `pcall()`.
+ *
+ *     cc -I.. -I/path/to/lua/include calltree_pcall.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_CALLTREE
+#define APILOG_QUIET
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+#include "lualib.h"
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    lua_pushvalue( L, 1 );
+    lua_call( L, 0, 0 );
+    return 0;
+}
+
+
+static int g( lua_State* L ) {
+    static char const* apilog_func = "g";
+    lua_newtable( L );
+    return 1;
+}
+
+
+static int h( lua_State* L ) {
+    static char const* apilog_func = "h";
+    lua_pushnil( L );
+    return 1;
+}
+
+
+static apilog_node const* child( apilog_node const* n,
+                                 char const* func, char const* api ) {
+    for( ; n != NULL; n = n->next )
+        if( strcmp( n->site->func, func ) == 0 &&
+            strcmp( n->site->api, api ) == 0 )
+            return n;
+    return NULL;
+}
+
+
+static char const code[] =
+    "for i = 1, 5 do pcall( f, function() error( 'x' ) end ) end\n"
+    "f( h )\n"
+    "g()\n";
+
+
+int main( void ) {
+    lua_State* L = luaL_newstate();
+    apilog_node const* call = NULL;
+    apilog_node const* push = NULL;
+    int failed = 0;
+    if( L == NULL )
+        return 1;
+    luaL_openlibs( L );
+    lua_pushcfunction( L, f );
+    lua_setglobal( L, "f" );
+    lua_pushcfunction( L, g );
+    lua_setglobal( L, "g" );
+    lua_pushcfunction( L, h );
+    lua_setglobal( L, "h" );
+    if( luaL_loadstring( L, code ) != 0 || lua_pcall( L, 0, 0, 0 ) != 0 ) {
+        fprintf( stderr, "%s\n", lua_tostring( L, -1 ) );
+        return 1;
+    }
+    lua_close( L );
+    call = child( apilog_roots, "f", "lua_call" );
+    /* failed calls must not become parents of later calls */
+    if( call == NULL || child( call->children, "f", "lua_call" ) != NULL ||
+        child( call->children, "f", "lua_pushvalue" ) != NULL ||
+        child( call->children, "g", "lua_newtable" ) != NULL ||
+        child( apilog_roots, "g", "lua_newtable" ) == NULL )
+        failed = 1;
+    push = child( apilog_roots, "f", "lua_pushvalue" );
+    if( push == NULL || push->calls != 6 )
+        failed = 1;
+    /* successful calls still nest */
+    push = call ? child( call->children, "h", "lua_pushnil" ) : NULL;
+    if( push == NULL || push->calls != 1 )
+        failed = 1;
+    if( failed ) {
+        fprintf( stderr, "calltree_pcall: FAILED\n" );
+        return 1;
+    }
+    printf( "calltree_pcall: ok\n" );
+    return 0;
+}
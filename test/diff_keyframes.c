@@ -0,0 +1,99 @@
+/* Checks the stack diffs and the keyframes of the diff mode: after the
+ * first call, after APILOG_KEYFRAME diffs, when another C function
+ * logs, and after calls that may run arbitrary code.
+ *
+ *     cc -I.. -I/path/to/lua/include diff_keyframes.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_DIFF
+#define APILOG_KEYFRAME 4
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#define LOGFILE "diff_keyframes.log"
+
+static int fline = 0;
+static int gline = 0;
+
+
+static int g( lua_State* L ) {
+    static char const* apilog_func = "g";
+    gline = __LINE__;
+    lua_pushboolean( L, 0 );
+    return 1;
+}
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    fline = __LINE__;
+    lua_settop( L, 0 );
+    lua_pushinteger( L, 1 );
+    lua_pushstring( L, "x" );
+    lua_pushvalue( L, 1 );
+    lua_replace( L, 2 );
+    lua_pushcfunction( L, g );
+    lua_call( L, 0, 1 );
+    lua_pushnil( L );
+    lua_pushnil( L );
+    lua_pop( L, 3 );
+    return 0;
+}
+
+
+int main( void ) {
+    static struct {
+        char const* api;
+        char const* func;
+        int line;
+        char const* stack;
+    } const expected[] = {
+        { "lua_settop", "f", 1, "[ ]" }, /* first call */
+        { "lua_pushinteger", "f", 2, "[ #1 1=i ]" },
+        { "lua_pushstring", "f", 3, "[ #2 2=s ]" },
+        { "lua_pushvalue", "f", 4, "[ #3 3=i ]" },
+        { "lua_replace", "f", 5, "[ #2 2=i ]" },
+        { "lua_pushcfunction", "f", 6, "[ i i f ]" }, /* 4 diffs */
+        { "lua_pushboolean", "g", 1, "[ b ]" }, /* new function */
+        { "lua_call", "f", 7, "[ i i b ]" }, /* may run code */
+        { "lua_pushnil", "f", 8, "[ #4 4=n ]" },
+        { "lua_pushnil", "f", 9, "[ #5 5=n ]" },
+        { "lua_pop", "f", 10, "[ #2 ]" }
+    };
+    size_t const n = sizeof( expected ) / sizeof( *expected );
+    lua_State* L = luaL_newstate();
+    FILE* log = NULL;
+    char line[ 512 ];
+    char want[ 512 ];
+    size_t i = 0;
+    int failed = 0;
+    if( L == NULL || freopen( LOGFILE, "w", stderr ) == NULL )
+        return 1;
+    lua_pushcfunction( L, f );
+    lua_call( L, 0, 0 );
+    lua_close( L );
+    fflush( stderr );
+    if( (log = fopen( LOGFILE, "r" )) == NULL )
+        return 1;
+    for( i = 0; fgets( line, sizeof( line ), log ) != NULL; ++i ) {
+        line[ strcspn( line, "\n" ) ] = '\0';
+        if( i < n ) {
+            sprintf( want, "%s in %s@%s:%d:  %s", expected[ i ].api,
+                     expected[ i ].func, __FILE__, expected[ i ].line +
+                     (*expected[ i ].func == 'f' ? fline : gline),
+                     expected[ i ].stack );
+            if( strcmp( line, want ) != 0 )
+                failed = 1;
+        }
+    }
+    fclose( log );
+    remove( LOGFILE );
+    if( failed || i != n ) {
+        printf( "diff_keyframes: FAILED\n" );
+        return 1;
+    }
+    printf( "diff_keyframes: ok\n" );
+    return 0;
+}
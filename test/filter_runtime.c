@@ -0,0 +1,93 @@
+/* Checks that the runtime filter selects the logged API calls by API
+ * function, C function, and file, and that call sites that were
+ * filtered out are logged again after the filter has changed.
+ *
+ *     cc -I.. -I/path/to/lua/include filter_runtime.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_FILTER
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#define LOGFILE "filter_runtime.log"
+
+static int fline = 0;
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    fline = __LINE__;
+    lua_pushinteger( L, 1 );
+    lua_pushnil( L );
+    lua_settop( L, 0 );
+    return 0;
+}
+
+
+static void run( lua_State* L, char const* spec ) {
+    apilog_filter( spec );
+    lua_pushcfunction( L, f );
+    lua_call( L, 0, 0 );
+}
+
+
+int main( void ) {
+    static struct {
+        char const* api;
+        int line;
+        char const* stack;
+    } const expected[] = {
+        /* api:lua_pushnil */
+        { "lua_pushnil", 2, "[ i n ]" },
+        /* func:f,api:lua_pushinteger,api:lua_settop */
+        { "lua_pushinteger", 1, "[ i ]" },
+        { "lua_settop", 3, "[ ]" },
+        /* func:g and file:other.c log nothing, then everything */
+        { "lua_pushinteger", 1, "[ i ]" },
+        { "lua_pushnil", 2, "[ i n ]" },
+        { "lua_settop", 3, "[ ]" },
+        /* file:filter_runtime.c matches the last path component */
+        { "lua_pushinteger", 1, "[ i ]" },
+        { "lua_pushnil", 2, "[ i n ]" },
+        { "lua_settop", 3, "[ ]" }
+    };
+    size_t const n = sizeof( expected ) / sizeof( *expected );
+    lua_State* L = luaL_newstate();
+    FILE* log = NULL;
+    char line[ 512 ];
+    char want[ 512 ];
+    size_t i = 0;
+    int failed = 0;
+    if( L == NULL || freopen( LOGFILE, "w", stderr ) == NULL )
+        return 1;
+    run( L, "api:lua_pushnil" );
+    run( L, "func:f,api:lua_pushinteger,api:lua_settop" );
+    run( L, "func:g" );
+    run( L, "file:other.c" );
+    run( L, NULL );
+    run( L, "file:filter_runtime.c" );
+    lua_close( L );
+    fflush( stderr );
+    if( (log = fopen( LOGFILE, "r" )) == NULL )
+        return 1;
+    for( i = 0; fgets( line, sizeof( line ), log ) != NULL; ++i ) {
+        line[ strcspn( line, "\n" ) ] = '\0';
+        if( i < n ) {
+            sprintf( want, "%s in f@%s:%d:  %s", expected[ i ].api,
+                     __FILE__, fline + expected[ i ].line,
+                     expected[ i ].stack );
+            if( strcmp( line, want ) != 0 )
+                failed = 1;
+        }
+    }
+    fclose( log );
+    remove( LOGFILE );
+    if( failed || i != n ) {
+        printf( "filter_runtime: FAILED\n" );
+        return 1;
+    }
+    printf( "filter_runtime: ok\n" );
+    return 0;
+}
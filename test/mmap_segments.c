@@ -0,0 +1,104 @@
+/* Checks that log lines of several threads written into small
+ * memory-mapped segments end up complete and in one piece, and that
+ * every segment is truncated to the bytes actually written.
+ *
+ *     cc -I.. -I/path/to/lua/include mmap_segments.c -llua -lm -pthread
+ *     ./a.out
+ */
+#define APILOG_MMAP
+#define APILOG_MMAP_FILE "mmap_segments.log"
+#define APILOG_BUFFER_SIZE 1024
+#define APILOG_SEGMENT_SIZE 4096
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+
+#define THREADS 4
+#define CALLS 2000
+#define MAXSEGMENTS 1000
+
+
+static void* run( void* arg ) {
+    static char const* apilog_func = "run";
+    lua_State* L = luaL_newstate();
+    int i = 0;
+    (void)arg;
+    if( L == NULL )
+        return NULL;
+    for( i = 0; i < CALLS; ++i ) {
+        if( i % 10 == 0 )
+            lua_settop( L, 0 );
+        else
+            lua_pushinteger( L, i );
+    }
+    lua_close( L );
+    return NULL;
+}
+
+
+static void cleanup( void ) {
+    char name[ 64 ];
+    int i = 0;
+    for( i = 0; i < MAXSEGMENTS; ++i ) {
+        sprintf( name, "%s.%d", APILOG_MMAP_FILE, i );
+        remove( name );
+    }
+}
+
+
+int main( void ) {
+    pthread_t threads[ THREADS ];
+    char name[ 64 ];
+    char prefix[ 512 ];
+    char line[ 512 ];
+    size_t count = 0;
+    int segments = 0;
+    int failed = 0;
+    int i = 0;
+    sprintf( prefix, "run@%s:", __FILE__ );
+    cleanup();
+    for( i = 0; i < THREADS; ++i )
+        if( pthread_create( threads+i, NULL, run, NULL ) != 0 )
+            return 1;
+    for( i = 0; i < THREADS; ++i )
+        pthread_join( threads[ i ], NULL );
+    apilog_flush();
+    apilog_mmap_close();
+    for( segments = 0; !failed && segments < MAXSEGMENTS; ++segments ) {
+        FILE* f = NULL;
+        long size = 0;
+        int c = 0;
+        int last = '\n';
+        sprintf( name, "%s.%d", APILOG_MMAP_FILE, segments );
+        if( (f = fopen( name, "rb" )) == NULL )
+            break;
+        while( (c = getc( f )) != EOF ) {
+            if( c == '\0' )
+                failed = 1;
+            last = c;
+            size++;
+        }
+        if( size == 0 || size > APILOG_SEGMENT_SIZE || last != '\n' )
+            failed = 1;
+        rewind( f );
+        while( !failed && fgets( line, sizeof( line ), f ) != NULL ) {
+            size_t len = strlen( line );
+            count++;
+            if( (strncmp( line, "lua_settop in run@", 18 ) != 0 &&
+                 strncmp( line, "lua_pushinteger in run@", 23 ) != 0) ||
+                strstr( line, prefix ) == NULL || len < 3 ||
+                strcmp( line+len-3, " ]\n" ) != 0 )
+                failed = 1;
+        }
+        fclose( f );
+    }
+    cleanup();
+    if( failed || segments < 2 || count != (size_t)THREADS*CALLS ) {
+        printf( "mmap_segments: FAILED\n" );
+        return 1;
+    }
+    printf( "mmap_segments: ok\n" );
+    return 0;
+}
@@ -0,0 +1,124 @@
+/* Checks the table sizes and the simulated rehashes that the table
+ * presizing advisor reports for some typical ways to fill tables.
+ *
+ *     cc -I.. -I/path/to/lua/include presize_rehash.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_PRESIZE
+#define APILOG_QUIET
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    int i = 0;
+    int j = 0;
+    for( j = 0; j < 100; ++j ) {
+        /* array part grows 1, 2, 4, 8, 16 */
+        lua_newtable( L );
+        for( i = 1; i <= 10; ++i ) {
+            lua_pushinteger( L, i );
+            lua_rawseti( L, -2, i );
+        }
+        lua_pop( L, 1 );
+        /* one rehash for the fifth field */
+        lua_createtable( L, 0, 4 );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "a" );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "b" );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "c" );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "d" );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "e" );
+        lua_pop( L, 1 );
+        /* presized, the repeated store doesn't count */
+        lua_createtable( L, 8, 2 );
+        for( i = 1; i <= 8; ++i ) {
+            lua_pushinteger( L, i );
+            lua_rawseti( L, -2, i );
+        }
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "a" );
+        lua_pushinteger( L, 2 );
+        lua_setfield( L, -2, "a" );
+        lua_pushinteger( L, 1 );
+        lua_setfield( L, -2, "b" );
+        lua_pop( L, 1 );
+    }
+    return 0;
+}
+
+
+static apilog_site const* find( char const* api ) {
+    size_t i = 0;
+    apilog_site const* found = NULL;
+    for( i = 0; i < APILOG_SITE_BUCKETS; ++i ) {
+        apilog_site const* s = apilog_sitetab[ i ];
+        for( ; s != NULL; s = s->next )
+            if( strcmp( s->api, api ) == 0 && s->ptables > 0 &&
+                (found == NULL || s->lineno < found->lineno) )
+                found = s;
+    }
+    return found;
+}
+
+
+static int check( apilog_site const* s, unsigned long arr,
+                  unsigned long rec, unsigned long rehashes ) {
+    return s != NULL && s->ptables == 100 && s->pmaxarr == arr &&
+           s->pmaxrec == rec && s->prehash == rehashes;
+}
+
+
+int main( void ) {
+    lua_State* L = luaL_newstate();
+    apilog_site const* s = NULL;
+    FILE* out = NULL;
+    char line[ 512 ];
+    int suggested = 0;
+    int failed = 0;
+    if( L == NULL )
+        return 1;
+    lua_pushcfunction( L, f );
+    lua_call( L, 0, 0 );
+    lua_close( L );
+    /* counts the tables that are still followed */
+    if( (out = tmpfile()) == NULL )
+        return 1;
+    apilog_presize_report( out );
+    rewind( out );
+    while( fgets( line, sizeof( line ), out ) != NULL )
+        if( strstr( line, "  lua_createtable( L, 10, 0 ) for "
+                          "lua_newtable in f@" ) != NULL )
+            suggested = 1;
+    fclose( out );
+    if( !suggested )
+        failed = 1;
+    if( !check( find( "lua_newtable" ), 10, 0, 500 ) )
+        failed = 1;
+    /* the first `lua_createtable()` has the lower line number */
+    s = find( "lua_createtable" );
+    if( !check( s, 0, 5, 100 ) )
+        failed = 1;
+    if( s != NULL ) {
+        size_t i = 0;
+        for( i = 0; i < APILOG_SITE_BUCKETS; ++i ) {
+            apilog_site const* t = apilog_sitetab[ i ];
+            for( ; t != NULL; t = t->next )
+                if( t != s && strcmp( t->api, "lua_createtable" ) == 0 &&
+                    !check( t, 8, 2, 0 ) )
+                    failed = 1;
+        }
+    }
+    if( failed ) {
+        fprintf( stderr, "presize_rehash: FAILED\n" );
+        return 1;
+    }
+    printf( "presize_rehash: ok\n" );
+    return 0;
+}
@@ -0,0 +1,121 @@
+/* Checks that a Lua panic dumps the recorded API calls once and then
+ * calls the original panic function of the right Lua universe.
+ *
+ *     cc -I.. -I/path/to/lua/include recorder_panic.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_RECORDER
+#define APILOG_RECORDER_SIZE 4
+#define APILOG_QUIET
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+
+
+#define LOGFILE "recorder_panic.log"
+
+static jmp_buf env;
+static int fline = 0;
+static int gline = 0;
+
+
+static int panic1( lua_State* L ) {
+    (void)L;
+    longjmp( env, 1 );
+    return 0;
+}
+
+
+static int panic2( lua_State* L ) {
+    (void)L;
+    longjmp( env, 2 );
+    return 0;
+}
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    int i = 0;
+    fline = __LINE__;
+    lua_settop( L, 0 );
+    for( i = 0; i < 5; ++i )
+        lua_pushinteger( L, i );
+    lua_pushstring( L, "boom" );
+    return lua_error( L );
+}
+
+
+static int g( lua_State* L ) {
+    static char const* apilog_func = "g";
+    gline = __LINE__;
+    lua_pushnil( L );
+    return 0;
+}
+
+
+/* Runs `fn` unprotected, returns the value passed to `longjmp()`. */
+static int run( lua_State* L, lua_CFunction fn ) {
+    int status = setjmp( env );
+    if( status == 0 ) {
+        lua_pushcfunction( L, fn );
+        lua_call( L, 0, 0 );
+    }
+    return status;
+}
+
+
+int main( void ) {
+    lua_State* L1 = luaL_newstate();
+    lua_State* L2 = luaL_newstate();
+    FILE* log = NULL;
+    static char text[ 4096 ];
+    char want[ 1024 ];
+    char const* p = NULL;
+    size_t n = 0;
+    int dumps = 0;
+    int failed = 0;
+    if( L1 == NULL || L2 == NULL ||
+        freopen( LOGFILE, "w", stderr ) == NULL )
+        return 1;
+    lua_atpanic( L1, panic1 );
+    lua_atpanic( L2, panic2 );
+    lua_pushcfunction( L1, g );
+    lua_call( L1, 0, 0 );
+    if( run( L2, f ) != 2 || run( L1, f ) != 1 )
+        failed = 1;
+    fflush( stderr );
+    if( (log = fopen( LOGFILE, "r" )) == NULL )
+        return 1;
+    n = fread( text, 1, sizeof( text )-1, log );
+    text[ n ] = '\0';
+    fclose( log );
+    remove( LOGFILE );
+    /* the ring keeps the last 4 calls */
+    sprintf( want, "apilog: last API calls on lua_State 0x%lx:\n"
+             "  lua_pushinteger in f@%s:%d:  top=3\n"
+             "  lua_pushinteger in f@%s:%d:  top=4\n"
+             "  lua_pushinteger in f@%s:%d:  top=5\n"
+             "  lua_pushstring in f@%s:%d:  top=6\n",
+             (unsigned long)(size_t)L2, __FILE__, fline+3, __FILE__,
+             fline+3, __FILE__, fline+3, __FILE__, fline+4 );
+    if( strstr( text, want ) == NULL )
+        failed = 1;
+    sprintf( want, "apilog: last API calls on lua_State 0x%lx:\n"
+             "  lua_pushnil in g@%s:%d:  top=1\n",
+             (unsigned long)(size_t)L1, __FILE__, gline+1 );
+    if( strstr( text, want ) == NULL )
+        failed = 1;
+    /* only the first panic dumps */
+    for( p = strstr( text, "apilog:" ); p != NULL;
+         p = strstr( p+1, "apilog:" ) )
+        dumps++;
+    if( dumps != 2 )
+        failed = 1;
+    if( failed ) {
+        printf( "recorder_panic: FAILED\n" );
+        return 1;
+    }
+    printf( "recorder_panic: ok\n" );
+    return 0;
+}
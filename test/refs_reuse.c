@@ -0,0 +1,86 @@
+/* Checks the live reference counts of `luaL_ref()` call sites when
+ * references are released by instrumented and uninstrumented calls
+ * to `luaL_unref()` and then handed out again.
+ *
+ *     cc -I.. -I/path/to/lua/include refs_reuse.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_REFS
+#define APILOG_QUIET
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+static int refs[ 20 ];
+
+
+static int a( lua_State* L ) {
+    static char const* apilog_func = "a";
+    int i = 0;
+    for( i = 0; i < 20; ++i ) {
+        lua_newtable( L );
+        refs[ i ] = luaL_ref( L, LUA_REGISTRYINDEX );
+    }
+    for( i = 0; i < 10; ++i )
+        luaL_unref( L, LUA_REGISTRYINDEX, refs[ i ] );
+    /* not seen by apilog */
+    for( i = 10; i < 15; ++i )
+        (luaL_unref)( L, LUA_REGISTRYINDEX, refs[ i ] );
+    return 0;
+}
+
+
+static int b( lua_State* L ) {
+    static char const* apilog_func = "b";
+    int i = 0;
+    /* Lua hands out the most recently released references first */
+    for( i = 0; i < 5; ++i ) {
+        lua_newtable( L );
+        luaL_ref( L, LUA_REGISTRYINDEX );
+    }
+    return 0;
+}
+
+
+static apilog_site const* find( char const* func, char const* api ) {
+    size_t i = 0;
+    for( i = 0; i < APILOG_SITE_BUCKETS; ++i ) {
+        apilog_site const* s = apilog_sitetab[ i ];
+        for( ; s != NULL; s = s->next )
+            if( strcmp( s->func, func ) == 0 && strcmp( s->api, api ) == 0 )
+                return s;
+    }
+    return NULL;
+}
+
+
+int main( void ) {
+    lua_State* L = luaL_newstate();
+    apilog_site const* sa = NULL;
+    apilog_site const* sb = NULL;
+    int failed = 0;
+    if( L == NULL )
+        return 1;
+    lua_pushcfunction( L, a );
+    lua_call( L, 0, 0 );
+    lua_pushcfunction( L, b );
+    lua_call( L, 0, 0 );
+    sa = find( "a", "luaL_ref" );
+    sb = find( "b", "luaL_ref" );
+    /* the reused references moved from `a` to `b` */
+    if( sa == NULL || sa->rmade != 20 || sa->rlive != 5 || sa->rpeak != 20 )
+        failed = 1;
+    if( sb == NULL || sb->rmade != 5 || sb->rlive != 5 )
+        failed = 1;
+    if( apilog_reftabs == NULL || apilog_reftabs->next != NULL ||
+        !apilog_reftabs->registry || apilog_reftabs->live != 10 )
+        failed = 1;
+    lua_close( L );
+    if( failed ) {
+        fprintf( stderr, "refs_reuse: FAILED\n" );
+        return 1;
+    }
+    printf( "refs_reuse: ok\n" );
+    return 0;
+}
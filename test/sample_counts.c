@@ -0,0 +1,80 @@
+/* Checks that sampling logs every APILOG_SAMPLE-th call of a call
+ * site with the number of skipped calls, that `apilog_sample()`
+ * changes the rate, and that the first logged call after skipped
+ * calls is a keyframe in diff mode.
+ *
+ *     cc -I.. -I/path/to/lua/include sample_counts.c -llua -lm
+ *     ./a.out
+ */
+#define APILOG_SAMPLE 3
+#define APILOG_DIFF
+#include "apilog.h"
+#include <stdio.h>
+#include <string.h>
+
+
+#define LOGFILE "sample_counts.log"
+
+static int fline = 0;
+
+
+static int f( lua_State* L ) {
+    static char const* apilog_func = "f";
+    int i = 0;
+    fline = __LINE__;
+    lua_settop( L, 0 );
+    for( i = 0; i < 7; ++i )
+        lua_pushinteger( L, i );
+    lua_pushnil( L );
+    apilog_sample( 1 );
+    lua_pushnil( L );
+    lua_pushnil( L );
+    return 0;
+}
+
+
+int main( void ) {
+    static struct {
+        char const* api;
+        int line;
+        char const* stack;
+    } const expected[] = {
+        { "lua_pushinteger", 3, "[ i i i ] (2 skipped)" },
+        { "lua_pushinteger", 3, "[ i i i i i i ] (2 skipped)" },
+        { "lua_pushnil", 6, "[ i i i i i i i n n ]" }, /* keyframe */
+        { "lua_pushnil", 7, "[ #10 10=n ]" }
+    };
+    size_t const n = sizeof( expected ) / sizeof( *expected );
+    lua_State* L = luaL_newstate();
+    FILE* log = NULL;
+    char line[ 512 ];
+    char want[ 512 ];
+    size_t i = 0;
+    int failed = 0;
+    if( L == NULL || freopen( LOGFILE, "w", stderr ) == NULL )
+        return 1;
+    lua_pushcfunction( L, f );
+    lua_call( L, 0, 0 );
+    lua_close( L );
+    fflush( stderr );
+    if( (log = fopen( LOGFILE, "r" )) == NULL )
+        return 1;
+    for( i = 0; fgets( line, sizeof( line ), log ) != NULL; ++i ) {
+        line[ strcspn( line, "\n" ) ] = '\0';
+        if( i < n ) {
+            sprintf( want, "%s in f@%s:%d:  %s", expected[ i ].api,
+                     __FILE__, fline + expected[ i ].line,
+                     expected[ i ].stack );
+            if( strcmp( line, want ) != 0 )
+                failed = 1;
+        }
+    }
+    fclose( log );
+    remove( LOGFILE );
+    if( failed || i != n ) {
+        printf( "sample_counts: FAILED\n" );
+        return 1;
+    }
+    printf( "sample_counts: ok\n" );
+    return 0;
+}